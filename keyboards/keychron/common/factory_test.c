@@ -19,12 +19,14 @@
 #include "via.h"
 
 #include "keychron_task.h"
+#include "soft_timer.h"
 #ifdef LK_WIRELESS_ENABLE
 #    include "transport.h"
 #    include "battery.h"
 #    include "lpm.h"
 #    include "lkbt51.h"
 #    include "indicator.h"
+#    include "trace.h"
 #endif
 #include "config.h"
 #include "version.h"
@@ -85,66 +87,60 @@ enum {
     OS_SWITCH = 0x01,
 };
 
-static uint32_t factory_reset_timer = 0;
-static uint8_t  factory_reset_state = 0;
-static uint8_t  backlight_test_mode = BACKLIGHT_TEST_OFF;
+static soft_timer_t factory_reset_timer;
+static uint8_t      factory_reset_state = 0;
+static uint8_t      backlight_test_mode = BACKLIGHT_TEST_OFF;
 
-static uint32_t factory_reset_ind_timer = 0;
-static uint8_t  factory_reset_ind_state = 0;
-static bool     report_os_sw_state      = false;
-static bool     keys_released           = true;
+static soft_timer_t factory_reset_ind_timer;
+static uint8_t      factory_reset_ind_state = 0;
+static bool         report_os_sw_state      = false;
+static bool         keys_released           = true;
 
-void factory_timer_start(void) {
-    factory_reset_timer = timer_read32();
+static void factory_reset_ind_timer_check(void *arg) {
+    if (factory_reset_ind_state++ > 6) {
+        factory_reset_ind_state = 0;
+    } else {
+        soft_timer_start(&factory_reset_ind_timer, 250, factory_reset_ind_timer_check, NULL);
+    }
 }
 
-static inline void factory_timer_check(void) {
-    if (timer_elapsed32(factory_reset_timer) > 3000) {
-        factory_reset_timer = 0;
-
-        if (factory_reset_state == KEY_PRESS_FACTORY_RESET) {
-            factory_reset_ind_timer = timer_read32();
-            factory_reset_ind_state++;
-            keys_released = false;
-
-            clear_keyboard(); // Avoid key being pressed after NKRO state changed
-            layer_state_t default_layer_tmp = default_layer_state;
-            eeconfig_init();
-            keymap_config.raw = eeconfig_read_keymap();
-            default_layer_set(default_layer_tmp);
+static void factory_timer_check(void *arg) {
+    if (factory_reset_state == KEY_PRESS_FACTORY_RESET) {
+        soft_timer_start(&factory_reset_ind_timer, 250, factory_reset_ind_timer_check, NULL);
+        factory_reset_ind_state++;
+        keys_released = false;
+
+        clear_keyboard(); // Avoid key being pressed after NKRO state changed
+        layer_state_t default_layer_tmp = default_layer_state;
+        eeconfig_init();
+        keymap_config.raw = eeconfig_read_keymap();
+        default_layer_set(default_layer_tmp);
 #ifdef LED_MATRIX_ENABLE
-            if (!led_matrix_is_enabled()) led_matrix_enable();
-            led_matrix_init();
+        if (!led_matrix_is_enabled()) led_matrix_enable();
+        led_matrix_init();
 #endif
 #ifdef RGB_MATRIX_ENABLE
-            if (!rgb_matrix_is_enabled()) rgb_matrix_enable();
-            rgb_matrix_init();
+        if (!rgb_matrix_is_enabled()) rgb_matrix_enable();
+        rgb_matrix_init();
 #endif
 #ifdef LK_WIRELESS_ENABLE
-            lkbt51_factory_reset(P2P4G_CELAR_MASK);
+        lkbt51_factory_reset(P2P4G_CELAR_MASK);
 #endif
-        } else if (factory_reset_state == KEY_PRESS_BACKLIGTH_TEST) {
+    } else if (factory_reset_state == KEY_PRESS_BACKLIGTH_TEST) {
 #ifdef LED_MATRIX_ENABLE
-            if (!led_matrix_is_enabled()) led_matrix_enable();
+        if (!led_matrix_is_enabled()) led_matrix_enable();
 #endif
 #ifdef RGB_MATRIX_ENABLE
-            if (!rgb_matrix_is_enabled()) rgb_matrix_enable();
+        if (!rgb_matrix_is_enabled()) rgb_matrix_enable();
 #endif
-            backlight_test_mode = BACKLIGHT_TEST_WHITE;
-        }
-
-        factory_reset_state = 0;
+        backlight_test_mode = BACKLIGHT_TEST_WHITE;
     }
+
+    factory_reset_state = 0;
 }
 
-static inline void factory_reset_ind_timer_check(void) {
-    if (factory_reset_ind_timer && timer_elapsed32(factory_reset_ind_timer) > 250) {
-        if (factory_reset_ind_state++ > 6) {
-            factory_reset_ind_timer = factory_reset_ind_state = 0;
-        } else {
-            factory_reset_ind_timer = timer_read32();
-        }
-    }
+void factory_timer_start(void) {
+    soft_timer_start(&factory_reset_timer, 3000, factory_timer_check, NULL);
 }
 
 bool process_record_factory_test(uint16_t keycode, keyrecord_t *record) {
@@ -163,7 +159,7 @@ bool process_record_factory_test(uint16_t keycode, keyrecord_t *record) {
                 factory_reset_state |= KEY_PRESS_FN;
             } else {
                 factory_reset_state &= ~KEY_PRESS_FN;
-                factory_reset_timer = 0;
+                soft_timer_stop(&factory_reset_timer);
             }
             break;
 #endif
@@ -174,7 +170,7 @@ bool process_record_factory_test(uint16_t keycode, keyrecord_t *record) {
                 if (factory_reset_state & KEY_PRESS_FN) return false;
             } else {
                 factory_reset_state &= ~KEY_PRESS_J;
-                factory_reset_timer = 0;
+                soft_timer_stop(&factory_reset_timer);
             }
             break;
         case KC_Z:
@@ -187,7 +183,7 @@ bool process_record_factory_test(uint16_t keycode, keyrecord_t *record) {
                 if ((factory_reset_state & KEY_PRESS_FN) && keycode == KC_Z) return false;
             } else {
                 factory_reset_state &= ~KEY_PRESS_Z;
-                factory_reset_timer = 0;
+                soft_timer_stop(&factory_reset_timer);
                 /* Avoid changing backlight effect on key released if FN_Z_KEY is mode*/
 
                 if (!keys_released && keycode >= QK_BACKLIGHT_ON && keycode <= RGB_MODE_TWINKLE) {
@@ -216,7 +212,7 @@ bool process_record_factory_test(uint16_t keycode, keyrecord_t *record) {
                 }
             } else {
                 factory_reset_state &= ~KEY_PRESS_BL_KEY1;
-                factory_reset_timer = 0;
+                soft_timer_stop(&factory_reset_timer);
             }
             break;
 #endif
@@ -238,7 +234,7 @@ bool process_record_factory_test(uint16_t keycode, keyrecord_t *record) {
                 }
             } else {
                 factory_reset_state &= ~KEY_PRESS_BL_KEY2;
-                factory_reset_timer = 0;
+                soft_timer_stop(&factory_reset_timer);
             }
             break;
 #endif
@@ -287,14 +283,7 @@ bool factory_test_indicator(void) {
 #endif
 
 bool factory_reset_indicating(void) {
-    return factory_reset_ind_timer;
-}
-
-bool factory_test_task(void) {
-    if (factory_reset_timer) factory_timer_check();
-    if (factory_reset_ind_timer) factory_reset_ind_timer_check();
-
-    return true;
+    return soft_timer_is_armed(&factory_reset_ind_timer);
 }
 
 void factory_test_send(uint8_t *payload, uint8_t length) {
@@ -335,7 +324,7 @@ void factory_test_rx(uint8_t *data, uint8_t length) {
         switch (data[1]) {
             case FACTORY_TEST_CMD_BACKLIGHT:
                 backlight_test_mode = data[2];
-                factory_reset_timer = 0;
+                soft_timer_stop(&factory_reset_timer);
                 break;
             case FACTORY_TEST_CMD_OS_SWITCH:
                 report_os_sw_state = data[2];
@@ -355,7 +344,7 @@ void factory_test_rx(uint8_t *data, uint8_t length) {
                         break;
                     /* Set INT state */
                     case 0xA2:
-                        kc_printf("pin %d\n\r", data[3]);
+                        trace_event(TRACE_FACTORY_INT_PIN, data[3], 0);
                         gpio_write_pin(LKBT51_INT_OUTPUT_PIN, data[3]);
                         break;
                         /* Report INT state */
@@ -17,7 +17,6 @@
 #pragma once
 
 #define FACTORY_RESET_CHECK process_record_factory_test
-#define FACTORY_RESET_TASK factory_test_task
 
 void factory_test_init(void);
 
@@ -27,7 +26,6 @@ bool factory_test_indicator(void);
 
 //void process_record_factory_test(uint16_t keycode, keyrecord_t *record);
 bool factory_reset_indicating(void);
-void factory_test_task(void);
 void factory_test_rx(uint8_t *data, uint8_t length);
 
 bool process_record_factory_test(uint16_t keycode, keyrecord_t *record);
@@ -18,6 +18,8 @@
 #include "keychron_common.h"
 #include "raw_hid.h"
 #include "version.h"
+#include "soft_timer.h"
+#include "profiler.h"
 
 #ifdef FACTORY_TEST_ENABLE
 #    include "factory_test.h"
@@ -26,10 +28,15 @@
 
 #ifdef LK_WIRELESS_ENABLE
 #    include "lkbt51.h"
+#    include "energy.h"
+#    include "lpm.h"
+#    include "link_stats.h"
+#    include "trace.h"
+#    include "loop_monitor.h"
 #endif
 
-bool     is_siri_active = false;
-uint32_t siri_timer     = 0;
+bool                is_siri_active = false;
+static soft_timer_t siri_timer;
 
 static uint8_t mac_keycode[4] = {
     KC_LOPT,
@@ -53,6 +60,12 @@ static key_combination_t key_comb_list[] = {
 };
 // clang-format on
 
+static void siri_release(void *arg) {
+    unregister_code(KC_LCMD);
+    unregister_code(KC_SPACE);
+    is_siri_active = false;
+}
+
 bool process_record_keychron_common(uint16_t keycode, keyrecord_t *record) {
     switch (keycode) {
         case KC_MCTRL:
@@ -86,7 +99,7 @@ bool process_record_keychron_common(uint16_t keycode, keyrecord_t *record) {
                     register_code(KC_LCMD);
                     register_code(KC_SPACE);
                 }
-                siri_timer = timer_read32();
+                soft_timer_start(&siri_timer, 500, siri_release, NULL);
             } else {
                 // Do something else when release
             }
@@ -129,12 +142,7 @@ bool process_record_keychron_common(uint16_t keycode, keyrecord_t *record) {
 }
 
 void keychron_common_task(void) {
-    if (is_siri_active && timer_elapsed32(siri_timer) > 500) {
-        unregister_code(KC_LCMD);
-        unregister_code(KC_SPACE);
-        is_siri_active = false;
-        siri_timer     = 0;
-    }
+    soft_timer_task();
 }
 
 #ifdef ENCODER_ENABLE
@@ -158,6 +166,12 @@ void encoder_cb_init(void) {
 #endif
 
 //__attribute__((weak)) bool raw_hid_receive_keychron(uint8_t *data, uint8_t length) { return true; }
+
+/* Macro upload and recording, implemented by keymaps that support it */
+__attribute__((weak)) bool macro_rx(uint8_t *data, uint8_t length) {
+    return false;
+}
+
 #define PROTOCOL_VERSION 0x02
 
 enum { kc_get_protocol_version = 0xA0, kc_get_firmware_version = 0xA1, kc_get_support_feature = 0xA2, kc_get_default_layer = 0xA3 };
@@ -183,6 +197,56 @@ void get_support_feature(uint8_t *data) {
         ;
 }
 
+/* Diagnostics, sub command in data[1], reply payload from data[3] */
+enum {
+    kc_diag_energy = 0x01, // page -> see energy_get_report()
+    kc_diag_wake   = 0x02, //      -> see lpm_get_wake_report()
+    kc_diag_lpm    = 0x03, // 0xFF resets -> see lpm_get_stats_report()
+    kc_diag_link   = 0x04, // page -> see link_stats_get_report()
+    kc_diag_trace  = 0x05, // 0xFF clears -> see trace_drain()
+    kc_diag_cycles = 0x06, // section, 0xFF resets -> see profiler_get_report()
+    kc_diag_loop   = 0x07, // page -> see loop_monitor_get_report()
+};
+
+#if defined(LK_WIRELESS_ENABLE) || defined(PROFILER_ENABLE)
+static void kc_diag_rx(uint8_t *data, uint8_t length) {
+    memset(&data[3], 0, length - 3);
+
+    switch (data[1]) {
+#    ifdef LK_WIRELESS_ENABLE
+        case kc_diag_energy:
+            energy_get_report(data[2], &data[3], length - 3);
+            break;
+        case kc_diag_wake:
+            lpm_get_wake_report(&data[3], length - 3);
+            break;
+        case kc_diag_lpm:
+            if (data[2] == 0xFF) lpm_reset_stats();
+            lpm_get_stats_report(&data[3], length - 3);
+            break;
+        case kc_diag_link:
+            link_stats_get_report(data[2], &data[3], length - 3);
+            break;
+        case kc_diag_trace:
+            if (data[2] == 0xFF) trace_clear();
+            trace_drain(&data[3], length - 3);
+            break;
+        case kc_diag_loop:
+            loop_monitor_get_report(data[2], &data[3], length - 3);
+            break;
+#    endif
+#    ifdef PROFILER_ENABLE
+        case kc_diag_cycles:
+            if (data[2] == 0xFF) profiler_reset();
+            profiler_get_report(data[2], &data[3], length - 3);
+            break;
+#    endif
+    }
+
+    raw_hid_send(data, length);
+}
+#endif
+
 bool kc_raw_hid_rx(uint8_t *data, uint8_t length) {
     // if (!raw_hid_receive_keychron(data, length))
     //     return false;
@@ -227,11 +291,19 @@ bool kc_raw_hid_rx(uint8_t *data, uint8_t length) {
             lkbt51_dfu_rx(data, length);
             break;
 #endif
+#if defined(LK_WIRELESS_ENABLE) || defined(PROFILER_ENABLE)
+        case 0xAD:
+            kc_diag_rx(data, length);
+            break;
+#endif
 #ifdef FACTORY_TEST_ENABLE
         case 0xAB:
             factory_test_rx(data, length);
             break;
 #endif
+        case 0xAC:
+            return macro_rx(data, length);
+
         default:
             return false;
     }
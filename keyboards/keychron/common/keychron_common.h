@@ -107,6 +107,7 @@ typedef struct PACKED {
 
 bool process_record_keychron_common(uint16_t keycode, keyrecord_t *record);
 void keychron_common_task(void);
+bool macro_rx(uint8_t *data, uint8_t length);
 
 #ifdef ENCODER_ENABLE
 void encoder_cb_init(void);
@@ -4,7 +4,13 @@ KEYCHRON_COMMON_DIR = common
 SRC += \
     $(KEYCHRON_COMMON_DIR)/keychron_task.c \
     $(KEYCHRON_COMMON_DIR)/keychron_common.c \
+    $(KEYCHRON_COMMON_DIR)/soft_timer.c \
     $(KEYCHRON_COMMON_DIR)/factory_test.c
 
+ifeq ($(strip $(PROFILER_ENABLE)), yes)
+    OPT_DEFS += -DPROFILER_ENABLE
+    SRC += $(KEYCHRON_COMMON_DIR)/profiler.c
+endif
+
 VPATH += $(TOP_DIR)/keyboards/keychron/$(KEYCHRON_COMMON_DIR)
 
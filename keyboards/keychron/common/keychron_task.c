@@ -75,9 +75,6 @@ void keychron_task(void) {
 #ifdef LK_WIRELESS_ENABLE
     extern void wireless_tasks(void);
     wireless_tasks();
-#endif
-#ifdef FACTORY_TEST_ENABLE
-    factory_test_task();
 #endif
     keychron_common_task();
 
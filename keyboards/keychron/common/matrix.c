@@ -15,6 +15,7 @@
  */
 
 #include "quantum.h"
+#include "profiler.h"
 
 #ifndef HC595_STCP
 #    define HC595_STCP B0
@@ -161,6 +162,25 @@ void select_all_cols(void) {
     }
 }
 
+void unselect_all_cols(void) {
+    unselect_cols();
+}
+
+/* Used by lpm.c to find the key that woke the MCU */
+uint32_t lpm_probe_col(uint8_t col) {
+    uint32_t rows = 0;
+
+    select_col(col);
+    HC595_delay(200);
+    for (uint8_t row_index = 0; row_index < MATRIX_ROWS; row_index++) {
+        if (readMatrixPin(row_pins[row_index]) == 0) rows |= 0x01UL << row_index;
+    }
+    unselect_col(col);
+    HC595_delay(200);
+
+    return rows;
+}
+
 static void matrix_read_rows_on_col(matrix_row_t current_matrix[], uint8_t current_col, matrix_row_t row_shifter) {
     // Select col
     select_col(current_col); // select col
@@ -198,6 +218,7 @@ void matrix_init_custom(void) {
 }
 
 bool matrix_scan_custom(matrix_row_t current_matrix[]) {
+    PROFILE_SCOPE(PROFILE_MATRIX_SCAN);
     matrix_row_t curr_matrix[MATRIX_ROWS] = {0};
 
     // Set col, read rows
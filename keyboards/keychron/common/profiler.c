@@ -0,0 +1,86 @@
+/* Copyright 2025 @ Keychron (https://www.keychron.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/******************************************************************************
+ *
+ *  Filename:      profiler.c
+ *
+ *  Description:   Min, average and max CPU cycles of the main loop hot paths,
+ *                 measured with the Cortex-M DWT cycle counter
+ *
+ ******************************************************************************/
+
+#include "quantum.h"
+#include "profiler.h"
+
+typedef struct {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+} profile_section_t;
+
+static profile_section_t sections[PROFILE_SECTION_MAX];
+static bool              running = false;
+
+void profiler_reset(void) {
+    memset(sections, 0, sizeof(sections));
+}
+
+void profiler_record(uint8_t section, uint32_t cycles) {
+    // The counter only runs once tracing is enabled, the first sample is meaningless
+    if (!running) {
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CYCCNT = 0;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+        running = true;
+        return;
+    }
+
+    if (section >= PROFILE_SECTION_MAX) return;
+
+    profile_section_t *s = &sections[section];
+
+    if (!s->count || cycles < s->min) s->min = cycles;
+    if (cycles > s->max) s->max = cycles;
+    s->sum += cycles;
+    s->count++;
+}
+
+static uint8_t put32(uint8_t *buf, uint32_t value) {
+    buf[0] = value & 0xFF;
+    buf[1] = (value >> 8) & 0xFF;
+    buf[2] = (value >> 16) & 0xFF;
+    buf[3] = (value >> 24) & 0xFF;
+    return 4;
+}
+
+/* Samples, min, average and max cycles of a section, little endian. Returns
+ * the length used */
+uint8_t profiler_get_report(uint8_t section, uint8_t *buf, uint8_t len) {
+    uint8_t i = 0;
+
+    if (section >= PROFILE_SECTION_MAX || len < 16) return 0;
+
+    profile_section_t *s = &sections[section];
+
+    i += put32(&buf[i], s->count);
+    i += put32(&buf[i], s->min);
+    i += put32(&buf[i], s->count ? s->sum / s->count : 0);
+    i += put32(&buf[i], s->max);
+
+    return i;
+}
@@ -0,0 +1,58 @@
+/* Copyright 2025 @ Keychron (https://www.keychron.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+enum {
+    PROFILE_MATRIX_SCAN,
+    PROFILE_PROCESS_RECORD,
+    PROFILE_RGB_EFFECT,
+    PROFILE_RGB_INDICATORS,
+    PROFILE_REPORT_BUFFER,
+    PROFILE_LKBT51,
+    PROFILE_SOFT_TIMER,
+    PROFILE_LPM,
+    PROFILE_SECTION_MAX,
+};
+
+#ifdef PROFILER_ENABLE
+#    include "hal.h"
+
+typedef struct {
+    uint32_t start;
+    uint8_t  section;
+} profile_scope_t;
+
+void    profiler_record(uint8_t section, uint32_t cycles);
+void    profiler_reset(void);
+uint8_t profiler_get_report(uint8_t section, uint8_t *buf, uint8_t len);
+
+static inline uint32_t profiler_cycles(void) {
+    return DWT->CYCCNT;
+}
+
+static inline void profile_scope_end(profile_scope_t *scope) {
+    profiler_record(scope->section, profiler_cycles() - scope->start);
+}
+
+/* Counts the DWT cycles from here to the end of the enclosing block, early
+ * returns included */
+#    define PROFILE_SCOPE(section) profile_scope_t profile_scope __attribute__((cleanup(profile_scope_end))) = {profiler_cycles(), section}
+#else
+#    define PROFILE_SCOPE(section)
+#endif
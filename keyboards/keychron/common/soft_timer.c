@@ -0,0 +1,86 @@
+/* Copyright 2025 @ Keychron (https://www.keychron.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "quantum.h"
+#include "soft_timer.h"
+#include "profiler.h"
+
+static soft_timer_t *timer_list = NULL;
+
+static void soft_timer_unlink(soft_timer_t *timer) {
+    for (soft_timer_t **p = &timer_list; *p; p = &(*p)->next) {
+        if (*p == timer) {
+            *p = timer->next;
+            break;
+        }
+    }
+    timer->next  = NULL;
+    timer->armed = false;
+}
+
+void soft_timer_start(soft_timer_t *timer, uint32_t delay, soft_timer_cb_t cb, void *arg) {
+    soft_timer_t **p;
+
+    if (timer->armed) soft_timer_unlink(timer);
+
+    timer->due   = timer_read32() + delay;
+    timer->cb    = cb;
+    timer->arg   = arg;
+    timer->armed = true;
+
+    // Keep the list ordered, timers with the same deadline run in start order
+    for (p = &timer_list; *p && timer_expired32(timer->due, (*p)->due); p = &(*p)->next)
+        ;
+    timer->next = *p;
+    *p          = timer;
+}
+
+void soft_timer_stop(soft_timer_t *timer) {
+    if (timer->armed) soft_timer_unlink(timer);
+}
+
+bool soft_timer_is_armed(const soft_timer_t *timer) {
+    return timer->armed;
+}
+
+/* Milliseconds until the next timer is due, SOFT_TIMER_NONE if none is armed */
+uint32_t soft_timer_next_deadline(void) {
+    if (!timer_list) return SOFT_TIMER_NONE;
+
+    return timer_expired32(timer_read32(), timer_list->due) ? 0 : TIMER_DIFF_32(timer_list->due, timer_read32());
+}
+
+void soft_timer_task(void) {
+    PROFILE_SCOPE(PROFILE_SOFT_TIMER);
+    uint32_t now = timer_read32();
+    uint8_t  due = 0;
+
+    if (!timer_list || !timer_expired32(now, timer_list->due)) return;
+
+    /* Only run the timers due now. One started again from its callback is
+     * queued behind them and runs on the next call */
+    for (soft_timer_t *timer = timer_list; timer && timer_expired32(now, timer->due); timer = timer->next)
+        due++;
+
+    while (due-- && timer_list && timer_expired32(now, timer_list->due)) {
+        soft_timer_t *timer = timer_list;
+
+        timer_list   = timer->next;
+        timer->next  = NULL;
+        timer->armed = false;
+        timer->cb(timer->arg);
+    }
+}
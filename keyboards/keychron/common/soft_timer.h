@@ -0,0 +1,43 @@
+/* Copyright 2025 @ Keychron (https://www.keychron.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SOFT_TIMER_NONE UINT32_MAX
+
+typedef void (*soft_timer_cb_t)(void *arg);
+
+/*
+ * One shot timer run from the main loop. Timers are kept in a list ordered
+ * by deadline, so soft_timer_task() only looks at the head when nothing is
+ * due. A callback may start its own timer again to make it periodic.
+ */
+typedef struct soft_timer {
+    struct soft_timer *next;
+    uint32_t           due;
+    bool               armed;
+    soft_timer_cb_t    cb;
+    void              *arg;
+} soft_timer_t;
+
+void     soft_timer_start(soft_timer_t *timer, uint32_t delay, soft_timer_cb_t cb, void *arg);
+void     soft_timer_stop(soft_timer_t *timer);
+bool     soft_timer_is_armed(const soft_timer_t *timer);
+uint32_t soft_timer_next_deadline(void);
+void     soft_timer_task(void);
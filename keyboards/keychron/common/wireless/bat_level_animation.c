@@ -3,6 +3,7 @@
 #include "wireless.h"
 #include "indicator.h"
 #include "lpm.h"
+#include "soft_timer.h"
 #if defined(PROTOCOL_CHIBIOS)
 #    include <usb_main.h>
 #elif if defined(PROTOCOL_LUFA)
@@ -35,11 +36,11 @@ enum {
     BAT_LVL_ANI_BLINK_ON,
 };
 
-static uint8_t  animation_state = 0;
-static uint32_t bat_lvl_ani_timer_buffer = 0;
-static uint8_t  bat_percentage;
-static uint8_t  cur_percentage;
-static uint32_t time_interval;
+static uint8_t      animation_state = 0;
+static soft_timer_t bat_lvl_ani_timer;
+static uint8_t      bat_percentage;
+static uint8_t      cur_percentage;
+static uint32_t     time_interval;
 #ifdef RGB_MATRIX_ENABLE
 static uint8_t r, g, b;
 #endif
@@ -47,22 +48,25 @@ static uint8_t r, g, b;
 extern indicator_config_t indicator_config;
 extern backlight_state_t  original_backlight_state;
 
+static void bat_level_animiation_tick(void *arg);
+
 void bat_level_animiation_start(uint8_t percentage) {
     /* Turn on backlight mode for indicator */
     indicator_enable();
 
-    animation_state          = BAT_LVL_ANI_GROWING;
-    bat_percentage           = percentage;
-    bat_lvl_ani_timer_buffer = timer_read32();
-    cur_percentage           = 0;
-    time_interval            = BAT_LEVEL_GROWING_INTERVAL;
+    animation_state = BAT_LVL_ANI_GROWING;
+    bat_percentage  = percentage;
+    cur_percentage  = 0;
+    time_interval   = BAT_LEVEL_GROWING_INTERVAL;
 #ifdef RGB_MATRIX_ENABLE
     r = g = b = 255;
 #endif
+    soft_timer_start(&bat_lvl_ani_timer, time_interval, bat_level_animiation_tick, NULL);
 }
 
 void bat_level_animiation_stop(void) {
     animation_state = BAT_LVL_ANI_NONE;
+    soft_timer_stop(&bat_lvl_ani_timer);
 }
 
 bool bat_level_animiation_actived(void) {
@@ -134,14 +138,11 @@ void bat_level_animiation_update(void) {
         default:
             break;
     }
-
-    bat_lvl_ani_timer_buffer = timer_read32();
 }
 
-void bat_level_animiation_task(void) {
-    if (animation_state && sync_timer_elapsed32(bat_lvl_ani_timer_buffer) > time_interval) {
-        bat_level_animiation_update();
-    }
+static void bat_level_animiation_tick(void *arg) {
+    bat_level_animiation_update();
+    if (animation_state) soft_timer_start(&bat_lvl_ani_timer, time_interval, bat_level_animiation_tick, NULL);
 }
 
 #endif
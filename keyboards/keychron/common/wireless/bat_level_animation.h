@@ -20,4 +20,3 @@ void bat_level_animiation_start(uint8_t percentage);
 void bat_level_animiation_stop(void);
 bool bat_level_animiation_actived(void);
 void bat_level_animiation_indicate(void);
-void bat_level_animiation_task(void);
@@ -24,8 +24,14 @@
 #include "rtc_timer.h"
 #include "analog.h"
 
-#define BATTERY_EMPTY_COUNT 10
-#define CRITICAL_LOW_COUNT 20
+/* How long the voltage has to stay below empty or shutdown before it counts.
+ * These used to be 10 and 20 checks at the fixed 3 s measure interval */
+#ifndef BATTERY_EMPTY_DEBOUNCE_MS
+#    define BATTERY_EMPTY_DEBOUNCE_MS 30000
+#endif
+#ifndef CRITICAL_LOW_DEBOUNCE_MS
+#    define CRITICAL_LOW_DEBOUNCE_MS 60000
+#endif
 
 /* Battery voltage resistive voltage divider setting of MCU */
 #ifndef RVD_R1
@@ -51,12 +57,65 @@
 #    define VOLTAGE_TRIM_RGB_MATRIX 60
 #endif
 
-static uint32_t bat_monitor_timer_buffer = 0;
+/* Weight of a new sample in the voltage filter is 1 / 2^BATTERY_FILTER_SHIFT */
+#ifndef BATTERY_FILTER_SHIFT
+#    define BATTERY_FILTER_SHIFT 3
+#endif
+/* Faster filter while sampling after power on so the level settles quickly */
+#ifndef BATTERY_FILTER_POWER_ON_SHIFT
+#    define BATTERY_FILTER_POWER_ON_SHIFT 1
+#endif
+
+typedef struct {
+    uint16_t voltage;
+    uint8_t  percentage;
+} battery_soc_point_t;
+
+_Static_assert(FULL_VOLTAGE_VALUE > EMPTY_VOLTAGE_VALUE && EMPTY_VOLTAGE_VALUE > SHUTDOWN_VOLTAGE_VALUE, "Battery voltage thresholds must be strictly decreasing");
+
+/* Point of the default curve, measured with full, empty and shutdown at
+ * 4100, 3500 and 3300 mV and scaled to the thresholds of the board */
+#define BATTERY_SOC_UPPER(mv) (EMPTY_VOLTAGE_VALUE + (FULL_VOLTAGE_VALUE - EMPTY_VOLTAGE_VALUE) * ((mv) - 3500) / 600)
+#define BATTERY_SOC_LOWER(mv) (SHUTDOWN_VOLTAGE_VALUE + (EMPTY_VOLTAGE_VALUE - SHUTDOWN_VOLTAGE_VALUE) * ((mv) - 3300) / 200)
+
+/* Li-ion discharge curve under typical keyboard load, highest voltage first */
+#ifndef BATTERY_SOC_CURVE
+// clang-format off
+#    define BATTERY_SOC_CURVE {                \
+        {FULL_VOLTAGE_VALUE,      100},         \
+        {BATTERY_SOC_UPPER(4000),  86},         \
+        {BATTERY_SOC_UPPER(3900),  72},         \
+        {BATTERY_SOC_UPPER(3800),  55},         \
+        {BATTERY_SOC_UPPER(3750),  44},         \
+        {BATTERY_SOC_UPPER(3700),  35},         \
+        {BATTERY_SOC_UPPER(3600),  26},         \
+        {EMPTY_VOLTAGE_VALUE,      20},         \
+        {BATTERY_SOC_LOWER(3400),   9},         \
+        {SHUTDOWN_VOLTAGE_VALUE,    0},         \
+    }
+// clang-format on
+#endif
+
+static const battery_soc_point_t soc_curve[] = BATTERY_SOC_CURVE;
+
+static uint64_t bat_monitor_timer_buffer = 0;
 static uint16_t voltage                  = FULL_VOLTAGE_VALUE;
-static uint8_t  bat_empty                = 0;
-static uint8_t  critical_low             = 0;
+static uint32_t voltage_filter           = 0; // Filtered voltage in 1/16 mV
+static bool     voltage_filter_valid     = false;
+static bool     bat_empty                = false;
+static bool     critical_low             = false;
+static uint64_t bat_empty_since          = 0; // rtc_timer_read64() time of the first check below the threshold, 0 if above
+static uint64_t critical_low_since       = 0;
 static uint8_t  bat_state;
 static uint8_t  power_on_sample = 0;
+#if defined(BAT_CHARGING_PIN)
+static uint64_t charge_state_timer_buffer = 0; // Charge state push, apart from the adaptive measure interval
+#endif
+
+static uint32_t measure_interval      = VOLTAGE_MEASURE_INTERVAL;
+static uint16_t last_measured_voltage = 0;
+static bool     measure_requested     = false;
+static bool     sample_received       = false;
 
 void battery_init(void) {
     bat_state = BAT_NOT_CHARGING;
@@ -93,6 +152,16 @@ __attribute__((weak)) void battery_measure(void) {
     lkbt51_read_state_reg(0x05, 0x02);
 }
 
+/* Voltage arrives with any LKBT51 event packet carrying LK_EVT_MSK_BATT.
+ * Packets we did not ask for count as a free sample, so the next periodic
+ * read over SPI can be skipped. */
+static void battery_sample_received(void) {
+    if (measure_requested)
+        measure_requested = false;
+    else
+        sample_received = true;
+}
+
 /* Calculate the voltage */
 __attribute__((weak)) void battery_calculate_voltage(bool vol_src_bt, uint16_t value) {
     uint16_t voltage;
@@ -102,72 +171,126 @@ __attribute__((weak)) void battery_calculate_voltage(bool vol_src_bt, uint16_t v
     else
         voltage = (uint32_t)value * 3300 / 1024 * (RVD_R1 + RVD_R2) / RVD_R2;
 
+    /* The LEDs pull the battery down, add back the drop for the current
+     * frame. get_load_ratio() follows the brightness of what is shown. */
 #ifdef LED_MATRIX_ENABLE
     if (led_matrix_is_enabled()) {
-        /* We assumpt it is linear relationship*/
-        uint32_t compensation = (VOLTAGE_TRIM_LED_MATRIX * led_matrix_driver.get_load_ratio());
-        voltage += compensation;
+        voltage += (uint32_t)VOLTAGE_TRIM_LED_MATRIX * led_matrix_driver.get_load_ratio();
     }
 #endif
 #ifdef RGB_MATRIX_ENABLE
     if (rgb_matrix_is_enabled()) {
-
-        /* We assumpt it is linear relationship*/
-        uint32_t compensation = (VOLTAGE_TRIM_LED_MATRIX * rgb_matrix_driver.get_load_ratio());
-        voltage += compensation;
+        voltage += (uint32_t)VOLTAGE_TRIM_RGB_MATRIX * rgb_matrix_driver.get_load_ratio();
     }
 #endif
 
-    battery_set_voltage(voltage);
+    battery_filter_voltage(voltage);
+    battery_sample_received();
+}
+
+/* Exponential moving average, so a single noisy sample can't flip the
+ * level or the empty/critical low checks */
+void battery_filter_voltage(uint16_t sample) {
+    if (!voltage_filter_valid) {
+        battery_set_voltage(sample);
+        return;
+    }
+
+    uint8_t shift = battery_power_on_sample() ? BATTERY_FILTER_POWER_ON_SHIFT : BATTERY_FILTER_SHIFT;
+    int32_t diff  = ((int32_t)sample << 4) - (int32_t)voltage_filter;
+
+    voltage_filter += diff / (1 << shift);
+    voltage         = (voltage_filter + 8) >> 4;
 }
 
 void battery_set_voltage(uint16_t value) {
-    voltage = value;
+    voltage              = value;
+    voltage_filter       = (uint32_t)value << 4;
+    voltage_filter_valid = true;
 }
 
 uint16_t battery_get_voltage(void) {
     return voltage;
 }
 
+uint32_t battery_get_measure_interval(void) {
+    return measure_interval;
+}
+
+/*
+ * Measure densely close to empty and whenever the voltage moves, and back
+ * off exponentially while it is stable at a high level. The LEDs make the
+ * voltage drop faster, so don't go sparser than the default while they are on.
+ */
+static void battery_update_interval(void) {
+    uint16_t delta = voltage > last_measured_voltage ? voltage - last_measured_voltage : last_measured_voltage - voltage;
+
+    last_measured_voltage = voltage;
+
+    if (voltage < EMPTY_VOLTAGE_VALUE + VOLTAGE_MEASURE_DENSE_MARGIN) {
+        measure_interval = VOLTAGE_MEASURE_INTERVAL_MIN;
+    } else if (delta >= VOLTAGE_MEASURE_STABLE_DELTA) {
+        measure_interval = VOLTAGE_MEASURE_INTERVAL;
+    } else if (measure_interval < VOLTAGE_MEASURE_INTERVAL_MAX) {
+        measure_interval = MIN(measure_interval * 2, VOLTAGE_MEASURE_INTERVAL_MAX);
+    }
+
+#if defined(LED_MATRIX_ENABLE) || defined(RGB_MATRIX_ENABLE)
+    if (indicator_is_enabled() && measure_interval > VOLTAGE_MEASURE_INTERVAL) measure_interval = VOLTAGE_MEASURE_INTERVAL;
+#endif
+}
+
 uint8_t battery_get_percentage(void) {
-    if (voltage > FULL_VOLTAGE_VALUE) return 100;
+    const uint8_t last = sizeof(soc_curve) / sizeof(soc_curve[0]) - 1;
+
+    if (voltage >= soc_curve[0].voltage) return soc_curve[0].percentage;
+
+    for (uint8_t i = 1; i <= last; i++) {
+        if (voltage >= soc_curve[i].voltage) {
+            const battery_soc_point_t *hi = &soc_curve[i - 1];
+            const battery_soc_point_t *lo = &soc_curve[i];
 
-    if (voltage > EMPTY_VOLTAGE_VALUE) {
-        return ((uint32_t)voltage - EMPTY_VOLTAGE_VALUE) * 80 / (FULL_VOLTAGE_VALUE - EMPTY_VOLTAGE_VALUE) + 20;
+            // A board curve that is not strictly decreasing has a flat step here
+            if (hi->voltage <= lo->voltage) return lo->percentage;
+
+            return lo->percentage + ((uint32_t)voltage - lo->voltage) * (hi->percentage - lo->percentage) / (hi->voltage - lo->voltage);
+        }
     }
 
-    if (voltage > SHUTDOWN_VOLTAGE_VALUE) {
-        return ((uint32_t)voltage - SHUTDOWN_VOLTAGE_VALUE) * 20 / (EMPTY_VOLTAGE_VALUE - SHUTDOWN_VOLTAGE_VALUE);
-    } else
-        return 0;
+    return soc_curve[last].percentage;
 }
 
 bool battery_is_empty(void) {
-    return bat_empty > BATTERY_EMPTY_COUNT;
+    return bat_empty;
 }
 
 bool battery_is_critical_low(void) {
-    return critical_low > CRITICAL_LOW_COUNT;
+    return critical_low;
+}
+
+/* True once the voltage has been below `threshold` for `debounce` ms */
+static bool battery_below_for(uint16_t threshold, uint64_t *since, uint32_t debounce) {
+    if (voltage >= threshold) {
+        *since = 0;
+        return false;
+    }
+
+    if (!*since) *since = rtc_timer_read64() | 1;
+    return rtc_timer_elapsed64(*since) >= debounce;
 }
 
 void battery_check_empty(void) {
-    if (voltage < EMPTY_VOLTAGE_VALUE) {
-        if (bat_empty <= BATTERY_EMPTY_COUNT) {
-            if (++bat_empty > BATTERY_EMPTY_COUNT) {
-                indicator_battery_low_enable(true);
-                power_on_sample = VOLTAGE_POWER_ON_MEASURE_COUNT;
-            }
-        }
+    if (!bat_empty && battery_below_for(EMPTY_VOLTAGE_VALUE, &bat_empty_since, BATTERY_EMPTY_DEBOUNCE_MS)) {
+        bat_empty = true;
+        indicator_battery_low_enable(true);
+        power_on_sample = VOLTAGE_POWER_ON_MEASURE_COUNT;
     }
 }
 
 void battery_check_critical_low(void) {
-    if (voltage < SHUTDOWN_VOLTAGE_VALUE) {
-        if (critical_low <= CRITICAL_LOW_COUNT) {
-            if (++critical_low > CRITICAL_LOW_COUNT) wireless_low_battery_shutdown();
-        }
-    } else if (critical_low <= CRITICAL_LOW_COUNT) {
-        critical_low = 0;
+    if (!critical_low && battery_below_for(SHUTDOWN_VOLTAGE_VALUE, &critical_low_since, CRITICAL_LOW_DEBOUNCE_MS)) {
+        critical_low = true;
+        wireless_low_battery_shutdown();
     }
 }
 
@@ -176,10 +299,11 @@ bool battery_power_on_sample(void) {
 }
 
 void battery_task(void) {
-    uint32_t t = rtc_timer_elapsed_ms(bat_monitor_timer_buffer);
+    uint32_t t = rtc_timer_elapsed64(bat_monitor_timer_buffer);
     if ((get_transport() & TRANSPORT_WIRELESS) && (wireless_get_state() == WT_CONNECTED || battery_power_on_sample())) {
 #if defined(BAT_CHARGING_PIN)
-        if (usb_power_connected() && t > VOLTAGE_MEASURE_INTERVAL) {
+        if (usb_power_connected() && rtc_timer_elapsed64(charge_state_timer_buffer) > VOLTAGE_MEASURE_INTERVAL) {
+            charge_state_timer_buffer = rtc_timer_read64();
             if (gpio_read_pin(BAT_CHARGING_PIN) == BAT_CHARGING_LEVEL)
                 lkbt51_update_bat_state(BAT_CHARGING);
             else
@@ -192,25 +316,29 @@ void battery_task(void) {
              && !indicator_is_enabled()
 #endif
              && t > BACKLIGHT_OFF_VOLTAGE_MEASURE_INTERVAL) ||
-            t > VOLTAGE_MEASURE_INTERVAL) {
+            t > measure_interval) {
 
             battery_check_empty();
             battery_check_critical_low();
+            battery_update_interval();
 
-            bat_monitor_timer_buffer = rtc_timer_read_ms();
-            if (bat_monitor_timer_buffer > RTC_MAX_TIME) {
-                bat_monitor_timer_buffer = 0;
-                rtc_timer_clear();
-            }
+            bat_monitor_timer_buffer = rtc_timer_read64();
 
-            battery_measure();
+            if (sample_received && !battery_power_on_sample()) {
+                sample_received = false;
+            } else {
+                measure_requested = true;
+                battery_measure();
+            }
             if (power_on_sample < VOLTAGE_POWER_ON_MEASURE_COUNT) power_on_sample++;
         }
     }
 
     if ((bat_empty || critical_low) && usb_power_connected()) {
-        bat_empty    = false;
-        critical_low = false;
+        bat_empty          = false;
+        critical_low       = false;
+        bat_empty_since    = 0;
+        critical_low_since = 0;
         indicator_battery_low_enable(false);
     }
 }
@@ -38,6 +38,25 @@ enum {
 #    define VOLTAGE_MEASURE_INTERVAL 3000
 #endif
 
+/* Bounds of the adaptive measure interval, see battery_update_interval() */
+#ifndef VOLTAGE_MEASURE_INTERVAL_MIN
+#    define VOLTAGE_MEASURE_INTERVAL_MIN 1000
+#endif
+
+#ifndef VOLTAGE_MEASURE_INTERVAL_MAX
+#    define VOLTAGE_MEASURE_INTERVAL_MAX 30000
+#endif
+
+/* Measure at VOLTAGE_MEASURE_INTERVAL_MIN this close (mV) above empty */
+#ifndef VOLTAGE_MEASURE_DENSE_MARGIN
+#    define VOLTAGE_MEASURE_DENSE_MARGIN 150
+#endif
+
+/* Voltage change (mV) between measures still considered stable */
+#ifndef VOLTAGE_MEASURE_STABLE_DELTA
+#    define VOLTAGE_MEASURE_STABLE_DELTA 10
+#endif
+
 #ifndef VOLTAGE_POWER_ON_MEASURE_COUNT
 #    define VOLTAGE_POWER_ON_MEASURE_COUNT 15
 #endif
@@ -51,8 +70,10 @@ void battery_stop(void);
 
 void     battery_measure(void);
 void     battery_calculate_voltage(bool vol_src_bt, uint16_t value);
+void     battery_filter_voltage(uint16_t sample);
 void     battery_set_voltage(uint16_t value);
 uint16_t battery_get_voltage(void);
+uint32_t battery_get_measure_interval(void);
 uint8_t  battery_get_percentage(void);
 bool     battery_is_empty(void);
 bool     battery_is_critical_low(void);
@@ -0,0 +1,204 @@
+/* Copyright 2025 @ Keychron (https://www.keychron.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/******************************************************************************
+ *
+ *  Filename:      energy.c
+ *
+ *  Description:   Estimates where the battery charge goes by integrating the
+ *                 time spent in each power state with a per state current
+ *
+ ******************************************************************************/
+
+#include "quantum.h"
+#include "wireless.h"
+#include "transport.h"
+#include "battery.h"
+#include "rtc_timer.h"
+#include "energy.h"
+
+static uint64_t charge[ENERGY_SOURCE_MAX];  // uA * ms
+static uint32_t time_ms[ENERGY_SOURCE_MAX]; // For ENERGY_SPI, number of transactions
+static uint32_t integrate_timer = 0;
+static uint64_t low_power_start = 0;
+static pm_t     low_power_mode  = PM_RUN;
+
+static inline void energy_add(energy_source_t source, uint32_t ua, uint32_t ms) {
+    charge[source] += (uint64_t)ua * ms;
+    time_ms[source] += ms;
+}
+
+static void energy_add_radio(uint32_t ms) {
+    if (!(get_transport() & TRANSPORT_WIRELESS)) return;
+
+    switch (wireless_get_state()) {
+        case WT_CONNECTED:
+            energy_add(ENERGY_RADIO_CONNECTED, ENERGY_RADIO_CONNECTED_UA, ms);
+            break;
+        case WT_PARING:
+        case WT_RECONNECTING:
+            energy_add(ENERGY_RADIO_ADVERTISING, ENERGY_RADIO_ADVERTISING_UA, ms);
+            break;
+        default:
+            break;
+    }
+}
+
+/* Charge the time since the last integration, with the MCU in `mcu` */
+static void energy_integrate_as(energy_source_t mcu, uint32_t mcu_ua) {
+    uint32_t ms = timer_elapsed32(integrate_timer);
+
+    integrate_timer = timer_read32();
+    if (ms == 0) return;
+
+    energy_add(mcu, mcu_ua, ms);
+    energy_add_radio(ms);
+
+#if defined(RGB_MATRIX_ENABLE)
+    if (rgb_matrix_is_enabled() && !rgb_matrix_is_driver_shutdown()) {
+        energy_add(ENERGY_LED, ENERGY_LED_LOAD_UA * rgb_matrix_driver.get_load_ratio(), ms);
+    }
+#elif defined(LED_MATRIX_ENABLE)
+    if (led_matrix_is_enabled() && !led_matrix_is_driver_shutdown()) {
+        energy_add(ENERGY_LED, ENERGY_LED_LOAD_UA * led_matrix_driver.get_load_ratio(), ms);
+    }
+#endif
+}
+
+static void energy_integrate(void) {
+    energy_integrate_as(ENERGY_MCU_RUN, ENERGY_MCU_RUN_UA);
+}
+
+void energy_init(void) {
+    energy_reset();
+}
+
+void energy_reset(void) {
+    memset(charge, 0, sizeof(charge));
+    memset(time_ms, 0, sizeof(time_ms));
+    integrate_timer = timer_read32();
+}
+
+void energy_spi_transfer(void) {
+    charge[ENERGY_SPI] += ENERGY_SPI_TRANSFER_UAMS;
+    time_ms[ENERGY_SPI]++;
+}
+
+/* The system timer stops in STOP mode, so time spent in low power mode is
+ * taken from the RTC backed monotonic clock instead */
+void energy_low_power_enter(pm_t mode) {
+    energy_integrate();
+    low_power_mode  = mode;
+    low_power_start = rtc_timer_read64();
+}
+
+void energy_low_power_exit(void) {
+    uint32_t ms = rtc_timer_elapsed64(low_power_start);
+
+    energy_add(low_power_mode == PM_SLEEP ? ENERGY_MCU_SLEEP : ENERGY_MCU_STOP, low_power_mode == PM_SLEEP ? ENERGY_MCU_SLEEP_UA : ENERGY_MCU_STOP_UA, ms);
+    energy_add_radio(ms);
+
+    low_power_mode  = PM_RUN;
+    integrate_timer = timer_read32();
+}
+
+/* A throttled main loop idles between scans: the thread sleeps and the
+ * ChibiOS idle thread waits in WFI (CORTEX_ENABLE_WFI_IDLE), or lpm_sleep()
+ * does. The system timer keeps running, so the time bracketed by these is
+ * charged as MCU sleep, with the LEDs and radio as usual */
+void energy_idle_begin(void) {
+    energy_integrate();
+}
+
+void energy_idle_end(void) {
+    energy_integrate_as(ENERGY_MCU_SLEEP, ENERGY_MCU_SLEEP_UA);
+}
+
+void energy_task(void) {
+    if (timer_elapsed32(integrate_timer) >= ENERGY_INTEGRATE_INTERVAL) energy_integrate();
+}
+
+uint32_t energy_get_charge_uah(energy_source_t source) {
+    return charge[source] / 3600000;
+}
+
+static uint64_t energy_total_charge(void) {
+    uint64_t total = 0;
+
+    for (uint8_t i = 0; i < ENERGY_SOURCE_MAX; i++)
+        total += charge[i];
+
+    return total;
+}
+
+static uint32_t energy_total_time(void) {
+    return time_ms[ENERGY_MCU_RUN] + time_ms[ENERGY_MCU_SLEEP] + time_ms[ENERGY_MCU_STOP];
+}
+
+uint32_t energy_get_average_ua(void) {
+    uint32_t ms = energy_total_time();
+
+    return ms ? energy_total_charge() / ms : 0;
+}
+
+static uint8_t put32(uint8_t *buf, uint32_t value) {
+    buf[0] = value & 0xFF;
+    buf[1] = (value >> 8) & 0xFF;
+    buf[2] = (value >> 16) & 0xFF;
+    buf[3] = (value >> 24) & 0xFF;
+    return 4;
+}
+
+/* Fill buf with one page of the estimate, little endian. Returns the length used */
+uint8_t energy_get_report(uint8_t page, uint8_t *buf, uint8_t len) {
+    uint8_t i = 0;
+
+    energy_integrate();
+
+    switch (page) {
+        case ENERGY_PAGE_SUMMARY: {
+            uint32_t avg_ua    = energy_get_average_ua();
+            uint32_t remaining = 0;
+
+            if (avg_ua) remaining = (uint64_t)BATTERY_CAPACITY_MAH * 1000 * battery_get_percentage() / 100 * 60 / avg_ua;
+
+            if (len < 19) return 0;
+            i += put32(&buf[i], energy_total_charge() / 3600000); // uAh
+            i += put32(&buf[i], energy_total_time() / 1000);      // s
+            i += put32(&buf[i], avg_ua);                          // uA
+            i += put32(&buf[i], remaining);                       // min
+            buf[i++] = battery_get_voltage() & 0xFF;
+            buf[i++] = battery_get_voltage() >> 8;
+            buf[i++] = battery_get_percentage();
+        } break;
+
+        case ENERGY_PAGE_CHARGE:
+            for (uint8_t s = 0; s < ENERGY_SOURCE_MAX && i + 4 <= len; s++)
+                i += put32(&buf[i], energy_get_charge_uah(s));
+            break;
+
+        case ENERGY_PAGE_TIME:
+            for (uint8_t s = 0; s < ENERGY_SOURCE_MAX && i + 4 <= len; s++)
+                i += put32(&buf[i], s == ENERGY_SPI ? time_ms[s] : time_ms[s] / 1000);
+            break;
+
+        case ENERGY_PAGE_RESET:
+            energy_reset();
+            break;
+    }
+
+    return i;
+}
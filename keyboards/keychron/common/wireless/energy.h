@@ -0,0 +1,89 @@
+/* Copyright 2025 @ Keychron (https://www.keychron.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "lpm.h"
+
+/* Average current (uA) of each state, measure and override per board */
+#ifndef ENERGY_MCU_RUN_UA
+#    define ENERGY_MCU_RUN_UA 9000
+#endif
+
+#ifndef ENERGY_MCU_SLEEP_UA
+#    define ENERGY_MCU_SLEEP_UA 3500
+#endif
+
+#ifndef ENERGY_MCU_STOP_UA
+#    define ENERGY_MCU_STOP_UA 40
+#endif
+
+/* LED current at a load ratio of 1, scaled by the driver's get_load_ratio() */
+#ifndef ENERGY_LED_LOAD_UA
+#    define ENERGY_LED_LOAD_UA 60000
+#endif
+
+#ifndef ENERGY_RADIO_CONNECTED_UA
+#    define ENERGY_RADIO_CONNECTED_UA 1200
+#endif
+
+#ifndef ENERGY_RADIO_ADVERTISING_UA
+#    define ENERGY_RADIO_ADVERTISING_UA 2500
+#endif
+
+/* Charge (uA * ms) of one SPI transaction with the wireless module */
+#ifndef ENERGY_SPI_TRANSFER_UAMS
+#    define ENERGY_SPI_TRANSFER_UAMS 400
+#endif
+
+#ifndef ENERGY_INTEGRATE_INTERVAL
+#    define ENERGY_INTEGRATE_INTERVAL 100
+#endif
+
+#ifndef BATTERY_CAPACITY_MAH
+#    define BATTERY_CAPACITY_MAH 4000
+#endif
+
+typedef enum {
+    ENERGY_MCU_RUN,
+    ENERGY_MCU_SLEEP,
+    ENERGY_MCU_STOP,
+    ENERGY_LED,
+    ENERGY_SPI,
+    ENERGY_RADIO_CONNECTED,
+    ENERGY_RADIO_ADVERTISING,
+    ENERGY_SOURCE_MAX,
+} energy_source_t;
+
+enum {
+    ENERGY_PAGE_SUMMARY,
+    ENERGY_PAGE_CHARGE,
+    ENERGY_PAGE_TIME,
+    ENERGY_PAGE_RESET = 0xFF,
+};
+
+void energy_init(void);
+void energy_reset(void);
+void energy_spi_transfer(void);
+void energy_low_power_enter(pm_t mode);
+void energy_low_power_exit(void);
+void energy_idle_begin(void);
+void energy_idle_end(void);
+void energy_task(void);
+
+uint32_t energy_get_charge_uah(energy_source_t source);
+uint32_t energy_get_average_ua(void);
+uint8_t  energy_get_report(uint8_t page, uint8_t *buf, uint8_t len);
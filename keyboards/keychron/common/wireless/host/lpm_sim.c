@@ -0,0 +1,565 @@
+/* Copyright 2025 @ Keychron (https://www.keychron.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/******************************************************************************
+ *
+ *  Filename:      lpm_sim.c
+ *
+ *  Description:   Runs lpm.c's stage policy and energy.c's estimate over a
+ *                 synthetic or recorded key trace on a virtual clock, to
+ *                 compare power policies and catch regressions in CI
+ *
+ ******************************************************************************/
+
+/*
+ * The main loop is modelled as one pass per ms at full rate. lpm_throttle(),
+ * lpm_sleep() and lpm_standby() advance the clock instead of waiting, sleep
+ * and standby up to the next event of the trace. The backlight stays on for
+ * --backlight seconds after the last key. The link stays connected over
+ * Bluetooth. USB power is plugged in and out by the trace; the charge used
+ * while it is in is not drawn from the battery and is reported apart.
+ * Battery measures and module interrupts do not wake the MCU, so the deep
+ * stages are as deep as the trace allows.
+ *
+ * A trace file has one event per line, "<ms> <row> <col> <1 press|0 release>"
+ * for a key or "<ms> usb <1 plugged|0 unplugged>" for USB power.
+ */
+
+#include <stdlib.h>
+#include "quantum.h"
+#include "wireless.h"
+#include "transport.h"
+#include "battery.h"
+#include "indicator.h"
+#include "lpm.h"
+#include "energy.h"
+#include "rtc_timer.h"
+#include "report_buffer.h"
+#include "soft_timer.h"
+#include "loop_monitor.h"
+
+#define SIM_DAY_MS (24UL * 3600 * 1000)
+#define SIM_HOUR_MS (3600UL * 1000)
+#define SIM_ROW_USB 0xFF // Row of a USB power event, pressed is plugged
+
+typedef struct {
+    uint32_t time;
+    uint8_t  row;
+    uint8_t  col;
+    bool     pressed;
+} sim_event_t;
+
+typedef struct {
+    uint32_t    days;
+    uint32_t    seed;
+    uint32_t    work_start_h;
+    uint32_t    work_hours;
+    uint32_t    usb_start_h;
+    uint32_t    usb_hours;
+    uint32_t    wpm;
+    uint32_t    backlight_s;
+    float       led_load;
+    uint32_t    wake_ms;
+    double      max_mah;
+    bool        require_stages;
+    const char *trace;
+} sim_options_t;
+
+static sim_options_t options = {
+    .days           = 1,
+    .seed           = 1,
+    .work_start_h   = 9,
+    .work_hours     = 8,
+    .usb_start_h    = 12,
+    .usb_hours      = 1,
+    .wpm            = 40,
+    .backlight_s    = CONNECTED_BACKLIGHT_DISABLE_TIMEOUT,
+    .led_load       = 0.2f,
+    .wake_ms        = 3,
+    .max_mah        = 0,
+    .require_stages = false,
+    .trace          = NULL,
+};
+
+static const lpm_stage_t sim_stages[] = LPM_STAGES;
+#define SIM_STAGE_COUNT ARRAY_SIZE(sim_stages)
+
+uint32_t     host_now_ms = 0;
+matrix_row_t matrix[MATRIX_ROWS];
+wt_func_t    wireless_transport;
+
+static sim_event_t *events;
+static uint32_t     event_count;
+static uint32_t     event_next;
+static uint32_t     keystrokes;
+static uint32_t     last_key_time;
+static uint32_t     sim_end;
+static uint8_t      sim_stage = LPM_STAGE_NONE;
+static uint64_t     stage_ms[SIM_STAGE_COUNT + 1]; // Last one is full rate
+static uint32_t     stage_entries[SIM_STAGE_COUNT];
+static uint32_t     stage_exits[SIM_STAGE_COUNT];
+static bool         usb_plugged;
+static uint32_t     usb_plugs;
+static uint32_t     usb_ms;
+static uint32_t     usb_since;
+static double       usb_mah;   // Charge used while on USB power
+static double       usb_start; // Charge used up to the last plug in
+
+/* Key trace */
+
+static uint32_t sim_rand(void) {
+    // xorshift32, the same seed gives the same day on every host
+    options.seed ^= options.seed << 13;
+    options.seed ^= options.seed >> 17;
+    options.seed ^= options.seed << 5;
+    return options.seed;
+}
+
+static uint32_t sim_rand_range(uint32_t min, uint32_t max) {
+    return min + sim_rand() % (max - min + 1);
+}
+
+static void sim_add_event(uint32_t time, uint8_t row, uint8_t col, bool pressed) {
+    static uint32_t capacity;
+
+    if (event_count == capacity) {
+        capacity = capacity ? capacity * 2 : 4096;
+        events   = realloc(events, capacity * sizeof(sim_event_t));
+        if (!events) {
+            fprintf(stderr, "lpm_sim: out of memory\n");
+            exit(2);
+        }
+    }
+    events[event_count++] = (sim_event_t){time, row, col, pressed};
+}
+
+static int sim_event_cmp(const void *a, const void *b) {
+    const sim_event_t *x = a, *y = b;
+
+    return x->time < y->time ? -1 : x->time > y->time;
+}
+
+/* Working hours of typing bursts and pauses, idle the rest of the day, and
+ * a charge over USB. The USB events are sorted in after the keys */
+static void sim_generate_day(uint32_t day) {
+    uint32_t t        = day * SIM_DAY_MS + options.work_start_h * SIM_HOUR_MS;
+    uint32_t work_end = t + options.work_hours * SIM_HOUR_MS;
+    uint32_t key_gap  = 60000 / (options.wpm * 5); // Five keys a word
+    uint32_t first    = event_count;
+
+    while (t < work_end) {
+        uint32_t burst_end = t + sim_rand_range(20, 300) * 1000;
+
+        while (t < burst_end && t < work_end) {
+            uint32_t hold = sim_rand_range(60, 120);
+
+            sim_add_event(t, sim_rand_range(1, MATRIX_ROWS - 1), sim_rand_range(0, MATRIX_COLS - 1), true);
+            sim_add_event(t + hold, events[event_count - 1].row, events[event_count - 1].col, false);
+            t += hold + sim_rand_range(key_gap / 4, key_gap * 7 / 4);
+        }
+
+        // Mostly short pauses for thinking, now and then a long one away from the desk
+        if (sim_rand() % 10 < 7)
+            t += sim_rand_range(2, 30) * 1000;
+        else
+            t += sim_rand_range(60, 1200) * 1000;
+    }
+
+    if (options.usb_hours) {
+        uint32_t plug = day * SIM_DAY_MS + options.usb_start_h * SIM_HOUR_MS;
+
+        sim_add_event(plug, SIM_ROW_USB, 0, true);
+        sim_add_event(plug + options.usb_hours * SIM_HOUR_MS, SIM_ROW_USB, 0, false);
+        qsort(&events[first], event_count - first, sizeof(sim_event_t), sim_event_cmp);
+    }
+}
+
+static bool sim_load_trace(const char *path) {
+    FILE    *f = fopen(path, "r");
+    char     line[128];
+    uint32_t last = 0;
+
+    if (!f) return false;
+
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long time;
+        unsigned      row, col, pressed;
+
+        if (line[0] == '#') continue;
+        if (sscanf(line, "%lu usb %u", &time, &pressed) == 2) {
+            row = SIM_ROW_USB;
+            col = 0;
+        } else if (sscanf(line, "%lu %u %u %u", &time, &row, &col, &pressed) != 4) {
+            continue;
+        }
+        if ((row != SIM_ROW_USB && (row >= MATRIX_ROWS || col >= MATRIX_COLS)) || time < last) {
+            fprintf(stderr, "lpm_sim: bad trace line: %s", line);
+            fclose(f);
+            return false;
+        }
+        sim_add_event(time, row, col, pressed);
+        last = time;
+    }
+    fclose(f);
+
+    return true;
+}
+
+static double sim_total_mah(void) {
+    double total = 0;
+
+    for (uint8_t s = 0; s < ENERGY_SOURCE_MAX; s++)
+        total += energy_get_charge_uah(s) / 1000.0;
+
+    return total;
+}
+
+/* USB power in or out. The charge meanwhile comes from USB, not the battery */
+static void sim_usb_power(bool plugged) {
+    if (plugged == usb_plugged) return;
+
+    energy_task();
+    if (plugged) {
+        usb_start = sim_total_mah();
+        usb_since = host_now_ms;
+        usb_plugs++;
+    } else {
+        usb_mah += sim_total_mah() - usb_start;
+        usb_ms += host_now_ms - usb_since;
+    }
+    usb_plugged = plugged;
+    lpm_timer_reset(); // The power sense pin wakes the MCU and counts as activity
+}
+
+/* Apply the events due, as the matrix scan and process_record would */
+static bool sim_keys_task(void) {
+    bool changed = false;
+
+    while (event_next < event_count && events[event_next].time <= host_now_ms) {
+        const sim_event_t *event = &events[event_next++];
+
+        if (event->row == SIM_ROW_USB) {
+            sim_usb_power(event->pressed);
+            continue;
+        }
+
+        if (event->pressed) {
+            matrix[event->row] |= (matrix_row_t)1 << event->col;
+            keystrokes++;
+        } else {
+            matrix[event->row] &= ~((matrix_row_t)1 << event->col);
+        }
+        changed = true;
+    }
+
+    if (changed) {
+        last_key_time = host_now_ms;
+        energy_spi_transfer(); // The report handed to the module
+        lpm_timer_reset();
+    }
+
+    return changed;
+}
+
+/* What lpm.c needs from the board, the drivers and the wireless code */
+
+bool matrix_is_on(uint8_t row, uint8_t col) {
+    return matrix[row] & ((matrix_row_t)1 << col);
+}
+
+bool lpm_matrix_peek(void) {
+    sim_stage = lpm_get_stage();
+    sim_keys_task();
+
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+        if (matrix[row]) return true;
+    }
+
+    return false;
+}
+
+/* Core sleep of a PM_SLEEP stage, ended by the period or the next key press */
+bool lpm_sleep(uint16_t period) {
+    uint32_t end = host_now_ms + period;
+
+    sim_stage = lpm_get_stage();
+    if (event_next < event_count && events[event_next].time < end) end = events[event_next].time;
+    if (end > host_now_ms) host_now_ms = end;
+
+    return lpm_matrix_peek();
+}
+
+void lpm_standby(pm_t mode) {
+    sim_stage = lpm_get_stage();
+
+    uint32_t wake = event_next < event_count ? events[event_next].time : sim_end;
+    if (wake > host_now_ms) host_now_ms = wake;
+}
+
+/* Clock and driver restore after wake up, counted in the wake latency */
+void lpm_post_wakeup(void) {
+    host_now_ms += options.wake_ms;
+}
+
+bool lpm_set(pm_t mode) {
+    return true;
+}
+
+bool usb_power_connected(void) {
+    return usb_plugged;
+}
+
+uint64_t rtc_timer_read64(void) {
+    return host_now_ms;
+}
+
+uint32_t rtc_timer_elapsed64(uint64_t last) {
+    return host_now_ms - last;
+}
+
+void rtc_timer_resync(void) {}
+
+static float sim_led_load(void) {
+    return options.led_load;
+}
+
+const led_matrix_driver_t led_matrix_driver = {
+    .flush          = NULL,
+    .get_load_ratio = sim_led_load,
+};
+
+bool led_matrix_is_enabled(void) {
+    return options.backlight_s;
+}
+
+bool led_matrix_is_driver_shutdown(void) {
+    return host_now_ms - last_key_time >= options.backlight_s * 1000;
+}
+
+void led_matrix_set_value_all(uint8_t value) {}
+
+void led_matrix_driver_shutdown(void) {}
+
+transport_t get_transport(void) {
+    return TRANSPORT_BLUETOOTH;
+}
+
+wt_state_t wireless_get_state(void) {
+    return WT_CONNECTED;
+}
+
+void battery_init(void) {}
+
+void battery_stop(void) {}
+
+uint16_t battery_get_voltage(void) {
+    return FULL_VOLTAGE_VALUE;
+}
+
+uint8_t battery_get_percentage(void) {
+    return 100;
+}
+
+bool indicator_is_running(void) {
+    return false;
+}
+
+bool report_buffer_is_empty(void) {
+    return true;
+}
+
+uint8_t report_buffer_inflight(void) {
+    return 0;
+}
+
+void report_buffer_init(void) {}
+
+void loop_monitor_block_begin(uint8_t site) {}
+
+void loop_monitor_block_end(void) {}
+
+/* Simulation */
+
+static void sim_run(void) {
+    uint8_t last_stage = LPM_STAGE_NONE;
+
+    energy_init();
+    lpm_init();
+
+    while (host_now_ms < sim_end) {
+        uint32_t start = host_now_ms;
+
+        sim_stage = LPM_STAGE_NONE;
+        sim_keys_task();
+        soft_timer_task();
+        energy_task();
+        lpm_task();
+
+        if (host_now_ms == start) host_now_ms++;
+        if (sim_stage >= SIM_STAGE_COUNT) sim_stage = LPM_STAGE_NONE;
+        stage_ms[sim_stage != LPM_STAGE_NONE ? sim_stage : SIM_STAGE_COUNT] += host_now_ms - start;
+
+        if (sim_stage != last_stage) {
+            if (last_stage != LPM_STAGE_NONE) stage_exits[last_stage]++;
+            if (sim_stage != LPM_STAGE_NONE) stage_entries[sim_stage]++;
+            last_stage = sim_stage;
+        }
+    }
+
+    if (usb_plugged) sim_usb_power(false);
+    energy_task();
+}
+
+static const char *sim_mode_name(pm_t mode) {
+    switch (mode) {
+        case PM_RUN:
+            return "run";
+        case PM_SLEEP:
+            return "sleep";
+        case PM_STOP:
+            return "stop";
+        default:
+            return "standby";
+    }
+}
+
+static uint32_t get32(const uint8_t *buf) {
+    return buf[0] | buf[1] << 8 | buf[2] << 16 | (uint32_t)buf[3] << 24;
+}
+
+/* Prints the estimate, returns the charge drawn from the battery */
+static double sim_report(void) {
+    static const char *const sources[ENERGY_SOURCE_MAX] = {"mcu run", "mcu sleep", "mcu stop", "led", "spi", "radio connected", "radio advertising"};
+    uint8_t                  stats[SIM_STAGE_COUNT * 4 + 8];
+    double                   battery = sim_total_mah() - usb_mah;
+    double                   hours   = (host_now_ms - usb_ms) / (double)SIM_HOUR_MS;
+
+    printf("lpm_sim: %.1f h on battery, %u keystrokes, %.3f mAh, %.0f h on %u mAh\n", hours, keystrokes, battery, battery ? BATTERY_CAPACITY_MAH * hours / battery : 0, BATTERY_CAPACITY_MAH);
+    printf("  %-18s %10.3f mAh over %.1f h, plugged in %u times\n", "on usb power", usb_mah, usb_ms / (double)SIM_HOUR_MS, usb_plugs);
+
+    for (uint8_t s = 0; s < ENERGY_SOURCE_MAX; s++)
+        printf("  %-18s %10.3f mAh\n", sources[s], energy_get_charge_uah(s) / 1000.0);
+
+    lpm_get_stats_report(stats, sizeof(stats));
+    printf("  %-18s %10.1f h\n", "full rate", stage_ms[SIM_STAGE_COUNT] / (double)SIM_HOUR_MS);
+    for (uint8_t i = 0; i < SIM_STAGE_COUNT; i++) {
+        printf("  stage %u %-7s %3u ms %6.1f h  entries %6u  exits %6u  short stays %5u%s\n", i, sim_mode_name(sim_stages[i].mode), sim_stages[i].throttle_ms, stage_ms[i] / (double)SIM_HOUR_MS, stage_entries[i], stage_exits[i], stats[i * 4 + 2] | stats[i * 4 + 3] << 8, sim_stages[i].dwell_ms ? "" : "  (off)");
+    }
+    printf("  %-18s entries %6u  exits %6u\n", "mcu low power", get32(&stats[SIM_STAGE_COUNT * 4]), get32(&stats[SIM_STAGE_COUNT * 4 + 4]));
+
+    return battery;
+}
+
+/* Every stage with a dwell has to be entered and left again */
+static bool sim_stages_reached(void) {
+    bool ok = true;
+
+    for (uint8_t i = 0; i < SIM_STAGE_COUNT; i++) {
+        if (sim_stages[i].dwell_ms && (!stage_entries[i] || !stage_exits[i])) {
+            printf("lpm_sim: stage %u (%s) was never %s\n", i, sim_mode_name(sim_stages[i].mode), stage_entries[i] ? "left" : "entered");
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+static void sim_usage(void) {
+    fprintf(stderr,
+            "usage: lpm_sim [options]\n"
+            "  --days N          days of synthetic trace (1)\n"
+            "  --seed N          trace seed (1)\n"
+            "  --work H,N        typing from hour H for N hours (9,8)\n"
+            "  --usb H,N         on USB power from hour H for N hours, N 0 never (12,1)\n"
+            "  --wpm N           typing speed in bursts (40)\n"
+            "  --backlight S     backlight timeout in seconds, 0 keeps it off (%u)\n"
+            "  --led-load F      LED load ratio while the backlight is on (0.2)\n"
+            "  --wake-ms N       wake up cost of a stop mode exit (3)\n"
+            "  --trace FILE      replay a recorded trace instead\n"
+            "  --max-mah F       exit 1 if the battery charge used is over F mAh\n"
+            "  --require-stages  exit 1 if a stage with a dwell is never entered and left\n",
+            CONNECTED_BACKLIGHT_DISABLE_TIMEOUT);
+    exit(2);
+}
+
+static void sim_parse(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg   = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (!strcmp(arg, "--require-stages")) {
+            options.require_stages = true;
+            continue;
+        }
+
+        if (!value) sim_usage();
+        i++;
+
+        if (!strcmp(arg, "--days"))
+            options.days = strtoul(value, NULL, 0);
+        else if (!strcmp(arg, "--seed"))
+            options.seed = strtoul(value, NULL, 0) ?: 1;
+        else if (!strcmp(arg, "--work")) {
+            if (sscanf(value, "%u,%u", &options.work_start_h, &options.work_hours) != 2) sim_usage();
+        } else if (!strcmp(arg, "--usb")) {
+            if (sscanf(value, "%u,%u", &options.usb_start_h, &options.usb_hours) != 2) sim_usage();
+        } else if (!strcmp(arg, "--wpm"))
+            options.wpm = strtoul(value, NULL, 0) ?: 1;
+        else if (!strcmp(arg, "--backlight"))
+            options.backlight_s = strtoul(value, NULL, 0);
+        else if (!strcmp(arg, "--led-load"))
+            options.led_load = strtof(value, NULL);
+        else if (!strcmp(arg, "--wake-ms"))
+            options.wake_ms = strtoul(value, NULL, 0);
+        else if (!strcmp(arg, "--trace"))
+            options.trace = value;
+        else if (!strcmp(arg, "--max-mah"))
+            options.max_mah = strtod(value, NULL);
+        else
+            sim_usage();
+    }
+
+    if (options.days == 0 || options.days > 30 || options.work_start_h + options.work_hours > 24 || options.usb_start_h + options.usb_hours > 24) sim_usage();
+}
+
+int main(int argc, char **argv) {
+    sim_parse(argc, argv);
+
+    if (options.trace) {
+        if (!sim_load_trace(options.trace)) {
+            fprintf(stderr, "lpm_sim: cannot read %s\n", options.trace);
+            return 2;
+        }
+        sim_end = event_count ? events[event_count - 1].time + 1 : 0;
+    } else {
+        for (uint32_t day = 0; day < options.days; day++)
+            sim_generate_day(day);
+        sim_end = options.days * SIM_DAY_MS;
+    }
+
+    sim_run();
+
+    double mah    = sim_report();
+    int    status = 0;
+
+    if (options.max_mah && mah > options.max_mah) {
+        printf("lpm_sim: %.3f mAh is over the %.3f mAh budget\n", mah, options.max_mah);
+        status = 1;
+    }
+    if (options.require_stages && !sim_stages_reached()) status = 1;
+
+    return status;
+}
@@ -0,0 +1,32 @@
+/* Copyright 2025 @ Keychron (https://www.keychron.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/* Board configuration of the host builds, a K10 Max sized matrix */
+
+#define MATRIX_ROWS 6
+#define MATRIX_COLS 21
+
+// clang-format off
+#define MATRIX_ROW_PINS { 0, 1, 2, 3, 4, 5 }
+#define MATRIX_COL_PINS { 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26 }
+// clang-format on
+
+#define LKBT51_INT_INPUT_PIN 30
+#define LKBT51_INT_OUTPUT_PIN 31
+
+#define BT_HOST_DEVICES_COUNT 3
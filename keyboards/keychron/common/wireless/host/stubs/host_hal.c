@@ -0,0 +1,73 @@
+/* Copyright 2025 @ Keychron (https://www.keychron.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/******************************************************************************
+ *
+ *  Filename:      host_hal.c
+ *
+ *  Description:   No-op HAL, GPIO and USB calls for the host builds. Waits
+ *                 advance the virtual clock instead of spinning
+ *
+ ******************************************************************************/
+
+#include "quantum.h"
+#include "debounce.h"
+#include "keychron_common.h"
+
+USBDriver USBD1 = {.state = USB_STOP};
+
+void wait_us(uint32_t us) {}
+
+void wait_ms(uint32_t ms) {
+    host_now_ms += ms;
+}
+
+void gpio_set_pin_output_push_pull(pin_t pin) {}
+
+void gpio_set_pin_input_high(pin_t pin) {}
+
+void gpio_write_pin(pin_t pin, uint8_t level) {}
+
+void gpio_write_pin_low(pin_t pin) {}
+
+void gpio_write_pin_high(pin_t pin) {}
+
+/* Rows are pulled up, nothing pressed */
+uint8_t gpio_read_pin(pin_t pin) {
+    return 1;
+}
+
+void palEnableLineEvent(pin_t pin, uint8_t mode) {}
+
+void palDisableLineEvent(pin_t pin) {}
+
+void halInit(void) {}
+
+void usbStop(USBDriver *usbp) {}
+
+void usbDisconnectBus(USBDriver *usbp) {}
+
+void usb_event_queue_init(void) {}
+
+void init_usb_driver(USBDriver *usbp) {}
+
+void matrix_init(void) {}
+
+void debounce_free(void) {}
+
+void action_exec(keyevent_t event) {}
+
+void encoder_cb_init(void) {}
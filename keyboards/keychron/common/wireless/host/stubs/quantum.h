@@ -0,0 +1,137 @@
+/* Copyright 2025 @ Keychron (https://www.keychron.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/* Stands in for QMK's quantum.h when wireless sources are built on the host.
+ * The timer runs on a virtual clock the test or simulator advances. The HAL,
+ * GPIO and driver calls are declared here and defined in host_hal.c */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include "config.h"
+
+#define NKRO_ENABLE
+#define WIRELESS_NKRO_ENABLE
+
+#define TRUE 1
+#define FALSE 0
+#define HAL_USE_SPI FALSE
+
+#ifndef ARRAY_SIZE
+#    define ARRAY_SIZE(array) (sizeof((array)) / sizeof((array)[0]))
+#endif
+
+/* Timer */
+extern uint32_t host_now_ms;
+
+static inline uint32_t timer_read32(void) {
+    return host_now_ms;
+}
+
+static inline uint32_t timer_elapsed32(uint32_t last) {
+    return host_now_ms - last;
+}
+
+#define TIMER_DIFF_32(a, b) ((uint32_t)((a) - (b)))
+#define timer_expired32(current, future) ((uint32_t)((current) - (future)) < UINT32_MAX / 2)
+#define sync_timer_elapsed32 timer_elapsed32
+
+void wait_us(uint32_t us);
+void wait_ms(uint32_t ms);
+
+/* GPIO */
+typedef uint8_t pin_t;
+#define NO_PIN 0xFF
+
+void    gpio_set_pin_output_push_pull(pin_t pin);
+void    gpio_set_pin_input_high(pin_t pin);
+void    gpio_write_pin(pin_t pin, uint8_t level);
+void    gpio_write_pin_low(pin_t pin);
+void    gpio_write_pin_high(pin_t pin);
+uint8_t gpio_read_pin(pin_t pin);
+
+#define PAL_EVENT_MODE_FALLING_EDGE 2
+#define PAL_EVENT_MODE_BOTH_EDGES 3
+
+void palEnableLineEvent(pin_t pin, uint8_t mode);
+void palDisableLineEvent(pin_t pin);
+void halInit(void);
+
+/* ChibiOS virtual timers and the Cortex-M sleep instructions */
+typedef struct {
+    uint32_t unused;
+} virtual_timer_t;
+
+#define TIME_MS2I(ms) (ms)
+
+static inline void chVTObjectInit(virtual_timer_t *vtp) {}
+static inline void chVTSet(virtual_timer_t *vtp, uint32_t delay, void (*vtfunc)(virtual_timer_t *, void *), void *par) {}
+static inline void chVTReset(virtual_timer_t *vtp) {}
+static inline void __WFI(void) {}
+static inline void __disable_irq(void) {}
+static inline void __enable_irq(void) {}
+
+/* USB */
+#define USB_STOP 1
+
+typedef struct {
+    uint8_t state;
+} USBDriver;
+
+extern USBDriver USBD1;
+#define USB_DRIVER USBD1
+
+void usbStop(USBDriver *usbp);
+void usbDisconnectBus(USBDriver *usbp);
+void usb_event_queue_init(void);
+void init_usb_driver(USBDriver *usbp);
+
+/* Matrix and actions */
+typedef uint32_t matrix_row_t;
+
+typedef struct {
+    uint8_t col;
+    uint8_t row;
+} keypos_t;
+
+typedef struct {
+    keypos_t key;
+    bool     pressed;
+} keyevent_t;
+
+#define MAKE_KEYEVENT(row_num, col_num, press) ((keyevent_t){.key = {.row = (row_num), .col = (col_num)}, .pressed = (press)})
+
+void matrix_init(void);
+bool matrix_is_on(uint8_t row, uint8_t col);
+void action_exec(keyevent_t event);
+
+/* LED matrix */
+#ifdef LED_MATRIX_ENABLE
+typedef struct {
+    void (*flush)(void);
+    float (*get_load_ratio)(void);
+} led_matrix_driver_t;
+
+extern const led_matrix_driver_t led_matrix_driver;
+
+bool led_matrix_is_enabled(void);
+bool led_matrix_is_driver_shutdown(void);
+void led_matrix_set_value_all(uint8_t value);
+void led_matrix_driver_shutdown(void);
+#endif
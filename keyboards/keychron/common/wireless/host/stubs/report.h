@@ -0,0 +1,49 @@
+/* Copyright 2025 @ Keychron (https://www.keychron.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/* The report layouts of QMK's report.h that the wireless code uses */
+
+#include <stdint.h>
+
+#define KEYBOARD_REPORT_KEYS 6
+#define NKRO_REPORT_BITS 30
+
+typedef struct {
+    uint8_t mods;
+    uint8_t reserved;
+    uint8_t keys[KEYBOARD_REPORT_KEYS];
+} report_keyboard_t;
+
+typedef struct {
+    uint8_t report_id;
+    uint8_t mods;
+    uint8_t bits[NKRO_REPORT_BITS];
+} report_nkro_t;
+
+typedef int8_t mouse_xy_report_t;
+#define MOUSE_REPORT_XY_MIN INT8_MIN
+#define MOUSE_REPORT_XY_MAX INT8_MAX
+
+typedef struct {
+    uint8_t           report_id;
+    uint8_t           buttons;
+    mouse_xy_report_t x;
+    mouse_xy_report_t y;
+    int8_t            v;
+    int8_t            h;
+} report_mouse_t;
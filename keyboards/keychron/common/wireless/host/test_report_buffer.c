@@ -0,0 +1,294 @@
+/* Copyright 2025 @ Keychron (https://www.keychron.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/******************************************************************************
+ *
+ *  Filename:      test_report_buffer.c
+ *
+ *  Description:   Host test of report_buffer.c against a fake transport that
+ *                 logs every frame handed to the module
+ *
+ ******************************************************************************/
+
+#include "quantum.h"
+#include "report_buffer.h"
+#include "wireless.h"
+#include "lpm.h"
+
+uint32_t host_now_ms = 1000;
+
+typedef struct {
+    uint8_t  type;
+    uint16_t value; // Key, usage or mouse x
+} sent_t;
+
+static sent_t  sent[64];
+static uint8_t sent_count;
+static uint8_t sn;
+static int     failures;
+
+#define CHECK(cond)                                                                       \
+    do {                                                                                  \
+        if (!(cond)) {                                                                    \
+            printf("%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #cond); \
+            failures++;                                                                   \
+        }                                                                                 \
+    } while (0)
+
+static void transport_frame(uint8_t type, uint16_t value) {
+    if (++sn == 0) sn++; // 0 is never used as sequence number
+    if (sent_count < ARRAY_SIZE(sent)) sent[sent_count++] = (sent_t){type, value};
+}
+
+static void send_keyboard(uint8_t *report) {
+    transport_frame(REPORT_TYPE_KB, ((report_keyboard_t *)report)->keys[0]);
+}
+
+static void send_nkro(uint8_t *report) {
+    transport_frame(REPORT_TYPE_NKRO, 0);
+}
+
+static void send_consumer(uint16_t usage) {
+    transport_frame(REPORT_TYPE_CONSUMER, usage);
+}
+
+static void send_system(uint16_t usage) {
+    transport_frame(REPORT_TYPE_SYSTEM, usage);
+}
+
+static void send_mouse(uint8_t *report) {
+    transport_frame(REPORT_TYPE_MOUSE, (uint8_t)((report_mouse_t *)report)->x);
+}
+
+static uint8_t last_sn(void) {
+    return sn;
+}
+
+wt_func_t wireless_transport = {
+    .send_keyboard = send_keyboard,
+    .send_nkro     = send_nkro,
+    .send_consumer = send_consumer,
+    .send_system   = send_system,
+    .send_mouse    = send_mouse,
+    .last_sn       = last_sn,
+};
+
+wt_state_t wireless_get_state(void) {
+    return WT_CONNECTED;
+}
+
+void lpm_timer_reset(void) {}
+
+void lpm_report_sent(void) {}
+
+static void setup(void) {
+    report_buffer_init();
+    sent_count  = 0;
+    host_now_ms += 100;
+}
+
+static void enqueue_key(uint8_t key) {
+    report_buffer_t report = {.type = REPORT_TYPE_KB};
+
+    report.keyboard.keys[0] = key;
+    CHECK(report_buffer_enqueue(&report));
+}
+
+static void enqueue_usage(uint8_t type, uint16_t usage) {
+    report_buffer_t report = {.type = type};
+
+    if (type == REPORT_TYPE_CONSUMER)
+        report.consumer = usage;
+    else
+        report.system = usage;
+    CHECK(report_buffer_enqueue(&report));
+}
+
+static bool enqueue_mouse(uint8_t buttons, int8_t x, int8_t v) {
+    report_buffer_t report = {.type = REPORT_TYPE_MOUSE};
+
+    report.mouse.buttons = buttons;
+    report.mouse.x       = x;
+    report.mouse.v       = v;
+    return report_buffer_enqueue(&report);
+}
+
+/* One report interval, then the module acks every frame sent in it */
+static void step(bool ack) {
+    uint8_t first = sent_count;
+
+    host_now_ms += DEFAULT_2P4G_REPORT_INVERVAL_MS + 1;
+    report_buffer_task();
+
+    if (ack)
+        for (uint8_t i = first; i < sent_count; i++) report_buffer_ack(sent[i].type, true);
+}
+
+static void run(uint8_t steps) {
+    while (steps--) step(true);
+}
+
+static void test_order_across_classes(void) {
+    setup();
+    enqueue_key(0x04);
+    enqueue_usage(REPORT_TYPE_CONSUMER, 0xE9);
+    enqueue_usage(REPORT_TYPE_SYSTEM, 0x82);
+    CHECK(enqueue_mouse(0, 10, 0));
+    enqueue_key(0x00);
+    enqueue_usage(REPORT_TYPE_CONSUMER, 0);
+    run(20);
+
+    const sent_t expected[] = {
+        {REPORT_TYPE_KB, 0x04}, {REPORT_TYPE_CONSUMER, 0xE9}, {REPORT_TYPE_SYSTEM, 0x82}, {REPORT_TYPE_MOUSE, 10}, {REPORT_TYPE_KB, 0x00}, {REPORT_TYPE_CONSUMER, 0},
+    };
+
+    CHECK(sent_count == ARRAY_SIZE(expected));
+    for (uint8_t i = 0; i < ARRAY_SIZE(expected) && i < sent_count; i++) {
+        CHECK(sent[i].type == expected[i].type && sent[i].value == expected[i].value);
+    }
+    CHECK(report_buffer_is_empty());
+    CHECK(report_buffer_inflight() == 0);
+}
+
+/* A release is held back while the press of the same class is unacked,
+ * a report of another class is not */
+static void test_class_waits_for_ack(void) {
+    setup();
+    enqueue_key(0x04);
+    enqueue_key(0x00);
+    enqueue_usage(REPORT_TYPE_CONSUMER, 0xE9);
+
+    step(false);
+    step(false);
+    CHECK(sent_count == 1 && sent[0].value == 0x04);
+
+    report_buffer_ack(REPORT_TYPE_KB, true);
+    run(4);
+    CHECK(sent_count == 3);
+    CHECK(sent[1].type == REPORT_TYPE_KB && sent[1].value == 0x00);
+    CHECK(sent[2].type == REPORT_TYPE_CONSUMER);
+}
+
+static void test_mouse_coalescing(void) {
+    setup();
+    enqueue_key(0x04);
+    uint16_t room = report_buffer_free();
+
+    // Movement behind another report is summed into the last mouse report
+    CHECK(enqueue_mouse(0, 10, 1));
+    CHECK(enqueue_mouse(0, 20, 2));
+    CHECK(report_buffer_free() == room - 1);
+
+    // A button change starts a new report
+    CHECK(enqueue_mouse(1, 5, 0));
+    CHECK(report_buffer_free() == room - 2);
+
+    // So does movement whose sum would not fit in the report
+    CHECK(enqueue_mouse(1, 120, 0));
+    CHECK(enqueue_mouse(1, 120, 0));
+    CHECK(report_buffer_free() == room - 3);
+
+    run(10);
+    CHECK(sent_count == 4);
+    CHECK(sent[1].type == REPORT_TYPE_MOUSE && sent[1].value == 30);
+    CHECK(sent[2].type == REPORT_TYPE_MOUSE && sent[2].value == 125);
+    CHECK(sent[3].type == REPORT_TYPE_MOUSE && sent[3].value == 120);
+}
+
+/* Mouse reports are not acked, so one goes out while a keyboard report is
+ * unacked. It still stays behind the reports queued before it */
+static void test_mouse_needs_no_ack(void) {
+    setup();
+    enqueue_key(0x04);
+    CHECK(enqueue_mouse(0, 1, 0));
+    enqueue_key(0x05);
+    CHECK(enqueue_mouse(0, 2, 0));
+
+    step(false);
+    step(false);
+    step(false);
+    CHECK(sent_count == 2);
+    CHECK(sent[1].type == REPORT_TYPE_MOUSE && sent[1].value == 1);
+}
+
+/* A NACKed press is sent again before the release behind it */
+static void test_nack_goes_back(void) {
+    setup();
+    enqueue_key(0x04);
+    enqueue_usage(REPORT_TYPE_CONSUMER, 0xE9);
+    enqueue_key(0x00);
+
+    step(false);
+    step(false);
+    CHECK(sent_count == 2);
+
+    report_buffer_ack(REPORT_TYPE_KB, false);
+    report_buffer_ack(REPORT_TYPE_CONSUMER, true);
+    run(10);
+
+    CHECK(sent_count == 4);
+    CHECK(sent[2].type == REPORT_TYPE_KB && sent[2].value == 0x04);
+    CHECK(sent[3].type == REPORT_TYPE_KB && sent[3].value == 0x00);
+    CHECK(report_buffer_inflight() == 0);
+}
+
+/* A frame never acked is resent after the timeout, and given up on after
+ * RETPORT_RETRY_COUNT resends so later reports still go out */
+static void test_timeout_and_give_up(void) {
+    setup();
+    enqueue_key(0x04);
+    step(false);
+    CHECK(sent_count == 1);
+
+    host_now_ms += REPORT_BUFFER_ACK_TIMEOUT_MS + 1;
+    step(false);
+    CHECK(sent_count == 2 && sent[1].value == 0x04);
+
+    for (uint16_t i = 0; i < RETPORT_RETRY_COUNT * 2; i++) {
+        host_now_ms += REPORT_BUFFER_ACK_TIMEOUT_MS + 1;
+        step(false);
+    }
+    CHECK(sent_count == 1 + RETPORT_RETRY_COUNT);
+
+    enqueue_key(0x00);
+    run(4);
+    CHECK(sent[sent_count - 1].value == 0x00);
+    CHECK(report_buffer_inflight() == 0);
+}
+
+/* A late ack of a class with nothing in flight is ignored */
+static void test_stray_ack(void) {
+    setup();
+    report_buffer_ack(REPORT_TYPE_SYSTEM, true);
+    report_buffer_ack(REPORT_TYPE_KB, false);
+    enqueue_key(0x04);
+    run(2);
+    CHECK(sent_count == 1);
+    CHECK(report_buffer_inflight() == 0);
+}
+
+int main(void) {
+    test_order_across_classes();
+    test_class_waits_for_ack();
+    test_mouse_coalescing();
+    test_mouse_needs_no_ack();
+    test_nack_goes_back();
+    test_timeout_and_give_up();
+    test_stray_ack();
+
+    printf("test_report_buffer: %s\n", failures ? "FAILED" : "passed");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,148 @@
+#!/usr/bin/env python3
+# Copyright 2025 @ Keychron (https://www.keychron.com)
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+"""Turn the 0xAD 0x05 diag trace replies into a timeline.
+
+Reads raw HID replies as hex, one 32 byte report per line, from files or
+stdin:
+
+    0xAD 0x05 <arg> count lost_lo lost_hi pending  records...
+
+each record being trace_record_t, little endian <u32 time, u8 id, u8 arg0,
+u16 arg1>. Event names and argument notes come from the enum in trace.h,
+so the decoder follows the firmware without edits.
+
+With --device VID:PID the ring is drained from the keyboard directly,
+which needs the hidapi python module.
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+DIAG_COMMAND = 0xAD
+DIAG_TRACE = 0x05
+RECORD = struct.Struct('<IBBH')
+HEADER = 3  # command, sub command, argument
+REPORT_LEN = 32
+
+TRACE_H = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'trace.h')
+
+
+def load_events(path):
+    """Map id -> (name, argument note) from the trace.h enum."""
+    with open(path) as f:
+        text = f.read()
+
+    body = re.search(r'enum\s*\{(.*?)\};', text, re.S).group(1)
+    events = {}
+    for index, match in enumerate(re.finditer(r'^[ \t]*(TRACE_\w+)[ \t]*,[ \t]*(?://[ \t]*(.*))?$', body, re.M)):
+        events[index] = (match.group(1)[len('TRACE_'):], (match.group(2) or '').strip())
+    return events
+
+
+def parse_report(report):
+    """Records of one reply, plus its lost and pending counts."""
+    if len(report) < HEADER + 4 or report[0] != DIAG_COMMAND or report[1] != DIAG_TRACE:
+        raise ValueError('not a trace reply: ' + report[:2].hex(' '))
+
+    count = report[HEADER]
+    lost = report[HEADER + 1] | report[HEADER + 2] << 8
+    pending = report[HEADER + 3]
+    offset = HEADER + 4
+    records = []
+
+    for _ in range(count):
+        if offset + RECORD.size > len(report):
+            raise ValueError('truncated reply')
+        records.append(RECORD.unpack_from(report, offset))
+        offset += RECORD.size
+
+    return records, lost, pending
+
+
+def read_hex(files):
+    for f in files:
+        for line in f:
+            line = line.split('#', 1)[0].strip()
+            if line:
+                yield bytes.fromhex(line.replace('0x', '').replace(',', ' '))
+
+
+def read_device(vid_pid):
+    import hid
+
+    vid, pid = (int(x, 16) for x in vid_pid.split(':'))
+    path = None
+    for info in hid.enumerate(vid, pid):
+        if info['usage_page'] == 0xFF60 and info['usage'] == 0x61:
+            path = info['path']
+    if path is None:
+        sys.exit('no raw HID interface on %04x:%04x' % (vid, pid))
+
+    dev = hid.device()
+    dev.open_path(path)
+    try:
+        while True:
+            dev.write(bytes([0, DIAG_COMMAND, DIAG_TRACE, 0]) + bytes(REPORT_LEN - HEADER))
+            report = bytes(dev.read(REPORT_LEN, 1000))
+            yield report
+            if not report or parse_report(report)[2] == 0:
+                break
+    finally:
+        dev.close()
+
+
+def timeline(reports, events, out):
+    first = None
+    last = None
+    wraps = 0
+
+    for report in reports:
+        records, lost, _ = parse_report(report)
+        if lost:
+            out.write('%12s %9s  -- %u records lost --\n' % ('', '', lost))
+
+        for time, event, arg0, arg1 in records:
+            # timer_read32() wraps after 49 days
+            if last is not None and time < (last & 0xFFFFFFFF) and (last & 0xFFFFFFFF) - time > 1 << 31:
+                wraps += 1
+            now = time + (wraps << 32)
+            if first is None:
+                first = now
+            delta = '' if last is None else '+%u' % (now - last)
+            last = now
+
+            name, note = events.get(event, ('%u' % event, ''))
+            out.write('%12.3f %9s  %-22s arg0=%-3u arg1=%-5u %s\n' % ((now - first) / 1000, delta, name, arg0, arg1, note))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('files', nargs='*', type=argparse.FileType('r'), help='hex dumps of the replies, stdin if none')
+    parser.add_argument('--device', metavar='VID:PID', help='drain the ring from the keyboard')
+    parser.add_argument('--trace-h', default=TRACE_H, help='trace.h to take the event names from')
+    args = parser.parse_args()
+
+    events = load_events(args.trace_h)
+    reports = read_device(args.device) if args.device else read_hex(args.files or [sys.stdin])
+    timeline(reports, events, sys.stdout)
+
+
+if __name__ == '__main__':
+    main()
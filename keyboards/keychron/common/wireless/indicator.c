@@ -29,6 +29,7 @@
 #endif
 #include "lpm.h"
 #include "keychron_task.h"
+#include "indicator_pattern.h"
 #if defined(LED_MATRIX_ENABLE) || defined(RGB_MATRIX_ENABLE)
 #    ifdef LED_MATRIX_ENABLE
 #        include "led_matrix.h"
@@ -52,7 +53,11 @@
 #    define DECIDE_TIME(t, duration) (duration == 0 ? RGB_MATRIX_TIMEOUT_INFINITE : ((t > duration) ? t : duration))
 #endif
 
-#define INDICATOR_SET(s) memcpy(&indicator_config, &s##_config, sizeof(indicator_config_t));
+#define INDICATOR_SET(s)                                                    \
+    do {                                                                    \
+        memcpy(&indicator_config, &s##_config, sizeof(indicator_config_t)); \
+        indicator_pattern = &s##_pattern;                                   \
+    } while (0)
 
 enum {
     BACKLIGHT_OFF            = 0x00,
@@ -60,20 +65,27 @@ enum {
     BACKLIGHT_ON_UNCONNECTED = 0x02,
 };
 
-static indicator_config_t pairing_config      = INDICATOR_CONFIG_PARING;
-static indicator_config_t connected_config    = INDICATOR_CONFIG_CONNECTD;
-static indicator_config_t reconnecting_config = INDICATOR_CONFIG_RECONNECTING;
-static indicator_config_t disconnected_config = INDICATOR_CONFIG_DISCONNECTED;
-indicator_config_t        indicator_config;
-static wt_state_t         indicator_state;
-static uint16_t           next_period;
-static indicator_type_t   type;
-static uint32_t           indicator_timer_buffer = 0;
+static const indicator_config_t pairing_config      = INDICATOR_CONFIG(INDICATOR_CONFIG_PARING);
+static const indicator_config_t connected_config    = INDICATOR_CONFIG(INDICATOR_CONFIG_CONNECTD);
+static const indicator_config_t reconnecting_config = INDICATOR_CONFIG(INDICATOR_CONFIG_RECONNECTING);
+static const indicator_config_t disconnected_config = INDICATOR_CONFIG(INDICATOR_CONFIG_DISCONNECTED);
+indicator_config_t              indicator_config;
+static wt_state_t               indicator_state;
+
+// clang-format off
+static const indicator_pattern_t pairing_pattern      = INDICATOR_PATTERN_FROM_CONFIG(INDICATOR_CONFIG_PARING);
+static const indicator_pattern_t connected_pattern    = INDICATOR_PATTERN_FROM_CONFIG(INDICATOR_CONFIG_CONNECTD);
+static const indicator_pattern_t reconnecting_pattern = INDICATOR_PATTERN_FROM_CONFIG(INDICATOR_CONFIG_RECONNECTING);
+static const indicator_pattern_t disconnected_pattern = INDICATOR_PATTERN_FROM_CONFIG(INDICATOR_CONFIG_DISCONNECTED);
+// clang-format on
+
+static const indicator_pattern_t *indicator_pattern;
+static indicator_player_t         host_player;
 
 #if defined(BAT_LOW_LED_PIN) || defined(SPACE_KEY_LOW_BAT_IND)
-static uint32_t bat_low_backlit_indicator = 0;
-static uint8_t  bat_low_ind_state         = 0;
-static uint32_t rtc_time                  = 0;
+static const indicator_pattern_t bat_low_pattern = INDICATOR_PATTERN_LOW_BAT;
+static indicator_player_t        bat_low_player;
+static uint64_t                  rtc_time = 0;
 #endif
 
 #if defined(LED_MATRIX_ENABLE) || defined(RGB_MATRIX_ENABLE)
@@ -103,7 +115,6 @@ static pin_t p24g_led_pin_list[P24G_HOST_DEVICES_COUNT] = P24G_INDICATION_LED_PI
 #    define SET_LED_ON(idx) led_matrix_set_value(idx, 255)
 #    define SET_LED_BT(idx) led_matrix_set_value(idx, 255)
 #    define SET_LED_P24G(idx) led_matrix_set_value(idx, 255)
-#    define SET_LED_LOW_BAT(idx) led_matrix_set_value(idx, 255)
 #    define LED_DRIVER_IS_ENABLED led_matrix_is_enabled
 #    define LED_DRIVER_EECONFIG_RELOAD()                                                           \
         eeprom_read_block(&led_matrix_eeconfig, EECONFIG_LED_MATRIX, sizeof(led_matrix_eeconfig)); \
@@ -130,7 +141,6 @@ static pin_t p24g_led_pin_list[P24G_HOST_DEVICES_COUNT] = P24G_INDICATION_LED_PI
 #    define SET_LED_ON(idx) rgb_matrix_set_color(idx, 255, 255, 255)
 #    define SET_LED_BT(idx) rgb_matrix_set_color(idx, 0, 0, 255)
 #    define SET_LED_P24G(idx) rgb_matrix_set_color(idx, 0, 255, 0)
-#    define SET_LED_LOW_BAT(idx) rgb_matrix_set_color(idx, 255, 0, 0)
 #    define LED_DRIVER_IS_ENABLED rgb_matrix_is_enabled
 #    define LED_DRIVER_EECONFIG_RELOAD()                                                       \
         eeprom_read_block(&rgb_matrix_config, EECONFIG_RGB_MATRIX, sizeof(rgb_matrix_config)); \
@@ -219,77 +229,19 @@ void indicator_eeconfig_reload(void) {
 bool indicator_is_running(void) {
     return
 #if defined(BAT_LOW_LED_PIN) || defined(SPACE_KEY_LOW_BAT_IND)
-        bat_low_ind_state ||
+        indicator_player_running(&bat_low_player) ||
 #endif
         !!indicator_config.value;
 }
 
-static void indicator_timer_cb(void *arg) {
-    if (*(indicator_type_t *)arg != INDICATOR_LAST) type = *(indicator_type_t *)arg;
-
-    bool time_up = false;
-    switch (type) {
-        case INDICATOR_NONE:
-            break;
-        case INDICATOR_OFF:
-            next_period = 0;
-            time_up     = true;
-            break;
-
-        case INDICATOR_ON:
-            if (indicator_config.value) {
-                if (indicator_config.elapsed == 0) {
-                    indicator_config.value |= LED_ON;
-
-                    if (indicator_config.duration) {
-                        indicator_config.elapsed += indicator_config.duration;
-                    }
-                } else
-                    time_up = true;
-            }
-            break;
-
-        case INDICATOR_ON_OFF:
-            if (indicator_config.value) {
-                if (indicator_config.elapsed == 0) {
-                    indicator_config.value |= LED_ON;
-                    next_period = indicator_config.on_time;
-                } else {
-                    indicator_config.value = indicator_config.value & 0x1F;
-                    next_period            = indicator_config.duration - indicator_config.on_time;
-                }
-
-                if ((indicator_config.duration == 0 || indicator_config.elapsed <= indicator_config.duration) && next_period != 0) {
-                    indicator_config.elapsed += next_period;
-                } else {
-                    time_up = true;
-                }
-            }
-            break;
-
-        case INDICATOR_BLINK:
-            if (indicator_config.value) {
-                if (indicator_config.value & LED_ON) {
-                    indicator_config.value = indicator_config.value & 0x1F;
-                    next_period            = indicator_config.off_time;
-                } else {
-                    indicator_config.value |= LED_ON;
-                    next_period = indicator_config.on_time;
-                }
-
-                if ((indicator_config.duration == 0 || indicator_config.elapsed <= indicator_config.duration) && next_period != 0) {
-                    indicator_config.elapsed += next_period;
-                } else {
-                    time_up = true;
-                }
-            }
-            break;
-        default:
-            time_up = true;
+/* Frame change of the connection indicator pattern */
+static void indicator_update(indicator_player_t *player) {
+    bool time_up = !indicator_player_running(player);
 
-            next_period = 0;
-            break;
-    }
+    if (indicator_player_colour(player) != IND_COLOUR_OFF)
+        indicator_config.value |= LED_ON;
+    else
+        indicator_config.value = indicator_config.value & 0x1F;
 
 #if defined(BT_INDICATION_LED_PIN_LIST) || defined(P24G_INDICATION_LED_PIN_LIST) || defined(COMMON_BT_LED_PIN) || defined(COMMON_P24G_LED_PIN)
     if (indicator_config.value) {
@@ -349,7 +301,7 @@ static void indicator_timer_cb(void *arg) {
     }
 #endif
 
-    if (time_up) {
+    if (time_up && indicator_config.value) {
         /* Set indicator to off on timeup, avoid keeping light up until next update in raindrop effect */
         indicator_config.value = indicator_config.value & 0x1F;
 #if defined(LED_MATRIX_ENABLE) || defined(RGB_MATRIX_ENABLE)
@@ -394,8 +346,6 @@ void indicator_set(wt_state_t state, uint8_t host_index) {
         return;
     }
 
-    indicator_timer_buffer = timer_read32();
-
 #if defined(LED_MATRIX_ENABLE) || defined(RGB_MATRIX_ENABLE)
     /* Turn on backlight mode for indicator */
     indicator_enable();
@@ -418,7 +368,7 @@ void indicator_set(wt_state_t state, uint8_t host_index) {
 #endif
             INDICATOR_SET(disconnected);
             indicator_config.value = (indicator_config.type == INDICATOR_NONE) ? 0 : host_index;
-            indicator_timer_cb((void *)&indicator_config.type);
+            indicator_player_start(&host_player, indicator_pattern, indicator_update);
 #if defined(LED_MATRIX_ENABLE) || defined(RGB_MATRIX_ENABLE)
             if (battery_is_critical_low()) {
                 indicator_set_backlit_timeout(1000);
@@ -437,7 +387,7 @@ void indicator_set(wt_state_t state, uint8_t host_index) {
             if (indicator_state != WT_CONNECTED) {
                 INDICATOR_SET(connected);
                 indicator_config.value = (indicator_config.type == INDICATOR_NONE) ? 0 : host_index;
-                indicator_timer_cb((void *)&indicator_config.type);
+                indicator_player_start(&host_player, indicator_pattern, indicator_update);
             }
 #if defined(LED_MATRIX_ENABLE) || defined(RGB_MATRIX_ENABLE)
             indicator_set_backlit_timeout(DECIDE_TIME(CONNECTED_BACKLIGHT_DISABLE_TIMEOUT * 1000, indicator_config.duration));
@@ -447,7 +397,7 @@ void indicator_set(wt_state_t state, uint8_t host_index) {
         case WT_PARING:
             INDICATOR_SET(pairing);
             indicator_config.value = (indicator_config.type == INDICATOR_NONE) ? 0 : LED_ON | host_index;
-            indicator_timer_cb((void *)&indicator_config.type);
+            indicator_player_start(&host_player, indicator_pattern, indicator_update);
 #if defined(LED_MATRIX_ENABLE) || defined(RGB_MATRIX_ENABLE)
             indicator_set_backlit_timeout(DECIDE_TIME(DISCONNECTED_BACKLIGHT_DISABLE_TIMEOUT * 1000, indicator_config.duration));
 #endif
@@ -456,7 +406,7 @@ void indicator_set(wt_state_t state, uint8_t host_index) {
         case WT_RECONNECTING:
             INDICATOR_SET(reconnecting);
             indicator_config.value = (indicator_config.type == INDICATOR_NONE) ? 0 : LED_ON | host_index;
-            indicator_timer_cb((void *)&indicator_config.type);
+            indicator_player_start(&host_player, indicator_pattern, indicator_update);
 #if defined(LED_MATRIX_ENABLE) || defined(RGB_MATRIX_ENABLE)
             indicator_set_backlit_timeout(DECIDE_TIME(DISCONNECTED_BACKLIGHT_DISABLE_TIMEOUT * 1000, indicator_config.duration));
 #endif
@@ -465,7 +415,7 @@ void indicator_set(wt_state_t state, uint8_t host_index) {
         case WT_SUSPEND:
             INDICATOR_SET(disconnected);
             indicator_config.value = (indicator_config.type == INDICATOR_NONE) ? 0 : host_index;
-            indicator_timer_cb((void *)&indicator_config.type);
+            indicator_player_start(&host_player, indicator_pattern, indicator_update);
 #if defined(LED_MATRIX_ENABLE) || defined(RGB_MATRIX_ENABLE)
 #    ifdef FACTORY_TEST_ENABLE
             if (factory_reset_indicating())
@@ -501,6 +451,7 @@ void indicator_set(wt_state_t state, uint8_t host_index) {
 
 void indicator_stop(void) {
     indicator_config.value = 0;
+    indicator_player_stop(&host_player);
 #if defined(LED_MATRIX_ENABLE) || defined(RGB_MATRIX_ENABLE)
     indicator_eeconfig_reload();
 
@@ -512,94 +463,52 @@ void indicator_stop(void) {
 #endif
 }
 
+#if defined(BAT_LOW_LED_PIN) || defined(SPACE_KEY_LOW_BAT_IND)
+static void indicator_battery_low_update(indicator_player_t *player) {
+#    if defined(BAT_LOW_LED_PIN)
+    gpio_write_pin(BAT_LOW_LED_PIN, indicator_player_colour(player) != IND_COLOUR_OFF ? BAT_LOW_LED_PIN_ON_STATE : !BAT_LOW_LED_PIN_ON_STATE);
+#    endif
+
+    if (!indicator_player_running(player)) {
+        /*  Restore backligth state */
+#    if defined(SPACE_KEY_LOW_BAT_IND)
+#        if defined(NUM_LOCK_INDEX) || defined(CAPS_LOCK_INDEX) || defined(SCROLL_LOCK_INDEX) || defined(COMPOSE_LOCK_INDEX) || defined(KANA_LOCK_INDEX)
+        if (LED_DRIVER_ALLOW_SHUTDOWN())
+#        endif
+            indicator_disable();
+#    endif
+        lpm_timer_reset();
+    }
+}
+#endif
+
 void indicator_battery_low_enable(bool enable) {
 #if defined(BAT_LOW_LED_PIN) || defined(SPACE_KEY_LOW_BAT_IND)
     if (enable) {
-        uint32_t t = rtc_timer_read_ms();
-
-        /* Check overflow */
-        if (rtc_time > t) {
-            if (bat_low_ind_state == 0)
-                rtc_time = t; // Update rtc_time if indicating is not running
-            else {
-                rtc_time += t;
-            }
-        }
+        uint64_t t = rtc_timer_read64();
 
         /* Indicating at first time or after the interval */
-        if ((rtc_time == 0 || t - rtc_time > LOW_BAT_LED_TRIG_INTERVAL) && bat_low_ind_state == 0) {
-            bat_low_backlit_indicator = enable ? timer_read32() : 0;
-            rtc_time                  = rtc_timer_read_ms();
-            bat_low_ind_state         = 1;
+        if ((rtc_time == 0 || t - rtc_time > LOW_BAT_LED_TRIG_INTERVAL) && !indicator_player_running(&bat_low_player)) {
+            rtc_time = t;
+            indicator_player_start(&bat_low_player, &bat_low_pattern, indicator_battery_low_update);
 #    if defined(SPACE_KEY_LOW_BAT_IND)
             indicator_enable();
 #    endif
         }
     } else {
-        rtc_time          = 0;
-        bat_low_ind_state = 0;
-#    if defined(SPACE_KEY_LOW_BAT_IND)
-        indicator_eeconfig_reload();
-        if (!LED_DRIVER_IS_ENABLED()) indicator_disable();
-#    endif
-    }
-#endif
-}
-
-void indicator_battery_low(void) {
-#if defined(BAT_LOW_LED_PIN) || defined(SPACE_KEY_LOW_BAT_IND)
-    if (bat_low_ind_state) {
-        if ((bat_low_ind_state & 0x0F) <= (LOW_BAT_LED_BLINK_TIMES) && timer_elapsed32(bat_low_backlit_indicator) > (LOW_BAT_LED_BLINK_PERIOD)) {
-            if (bat_low_ind_state & 0x80) {
-                bat_low_ind_state &= 0x7F;
-                bat_low_ind_state++;
-#    if defined(BAT_LOW_LED_PIN)
-                gpio_write_pin(BAT_LOW_LED_PIN, !BAT_LOW_LED_PIN_ON_STATE);
-#    endif
-            } else {
-                bat_low_ind_state |= 0x80;
-#    if defined(BAT_LOW_LED_PIN)
-                gpio_write_pin(BAT_LOW_LED_PIN, BAT_LOW_LED_PIN_ON_STATE);
-#    endif
-            }
-
-            bat_low_backlit_indicator = timer_read32();
-
-            /*  Restore backligth state */
-            if ((bat_low_ind_state & 0x0F) > (LOW_BAT_LED_BLINK_TIMES)) {
+        rtc_time = 0;
+        indicator_player_stop(&bat_low_player);
 #    if defined(BAT_LOW_LED_PIN)
-                gpio_write_pin(BAT_LOW_LED_PIN, !BAT_LOW_LED_PIN_ON_STATE);
+        gpio_write_pin(BAT_LOW_LED_PIN, !BAT_LOW_LED_PIN_ON_STATE);
 #    endif
 #    if defined(SPACE_KEY_LOW_BAT_IND)
-#        if defined(NUM_LOCK_INDEX) || defined(CAPS_LOCK_INDEX) || defined(SCROLL_LOCK_INDEX) || defined(COMPOSE_LOCK_INDEX) || defined(KANA_LOCK_INDEX)
-                if (LED_DRIVER_ALLOW_SHUTDOWN())
-#        endif
-                    indicator_disable();
-#    endif
-            }
-        } else if ((bat_low_ind_state & 0x0F) > (LOW_BAT_LED_BLINK_TIMES)) {
-#    if defined(BAT_LOW_LED_PIN)
-            gpio_write_pin(BAT_LOW_LED_PIN, !BAT_LOW_LED_PIN_ON_STATE);
+        indicator_eeconfig_reload();
+        if (!LED_DRIVER_IS_ENABLED()) indicator_disable();
 #    endif
-            bat_low_ind_state = 0;
-            lpm_timer_reset();
-        }
     }
 #endif
 }
 
-void indicator_task(void) {
-#if defined(BAT_LEVEL_LED_LIST)
-    bat_level_animiation_task();
-#endif
-    if (indicator_config.value && timer_elapsed32(indicator_timer_buffer) >= next_period) {
-        indicator_timer_cb((void *)&type);
-        indicator_timer_buffer = timer_read32();
-    }
-
-    indicator_battery_low();
-}
-
 #if defined(LED_MATRIX_ENABLE) || defined(RGB_MATRIX_ENABLE)
 __attribute__((weak)) void os_state_indicate(void) {
 #    if defined(RGB_MATRIX_SLEEP) || defined(LED_MATRIX_SLEEP)
@@ -641,6 +550,21 @@ __attribute__((weak)) void os_state_indicate(void) {
 #    endif
 }
 
+/* LED matrix index of the host being indicated, NO_LED if it has none */
+static uint8_t indicator_host_led(void) {
+    uint8_t host_index = indicator_config.value & HOST_INDEX_MASK;
+
+#    ifdef P24G_INDICATION_LED_MATRIX_INDEX
+    if (indicator_config.value & HOST_P2P4G) return P24G_INDICATION_LED_MATRIX_INDEX;
+#    endif
+#    ifdef BT_INDCATION_LED_MATRIX_LIST
+    if (!(indicator_config.value & HOST_P2P4G) && host_index >= 1 && host_index <= BT_HOST_DEVICES_COUNT) return bt_ind_led_matrix_list[host_index - 1];
+#    endif
+    (void)host_index;
+
+    return NO_LED;
+}
+
 bool LED_INDICATORS_KB(void) {
     if (get_transport() & TRANSPORT_WIRELESS) {
         /* Prevent backlight flash caused by key activities */
@@ -650,17 +574,13 @@ bool LED_INDICATORS_KB(void) {
         }
 
         if (battery_is_empty()) SET_ALL_LED_OFF();
+
+        indicator_led_set_t sets[IND_LEDS_MAX] = {0};
 #    if defined(LOW_BAT_IND_INDEX)
-        if (bat_low_ind_state && (bat_low_ind_state & 0x0F) <= LOW_BAT_LED_BLINK_TIMES) {
-            uint8_t idx_list[] = LOW_BAT_IND_INDEX;
-            for (uint8_t i = 0; i < sizeof(idx_list); i++) {
-                if (bat_low_ind_state & LED_ON) {
-                    SET_LED_LOW_BAT(idx_list[i]);
-                } else {
-                    SET_LED_OFF(idx_list[i]);
-                }
-            }
-        }
+        static const uint8_t low_bat_leds[] = LOW_BAT_IND_INDEX;
+
+        sets[IND_LEDS_LOW_BAT] = (indicator_led_set_t){low_bat_leds, sizeof(low_bat_leds)};
+        if (indicator_player_running(&bat_low_player)) indicator_player_render(&bat_low_player, sets, IND_COLOUR_HOST);
 #    endif
 
 #    if (defined(LED_MATRIX_ENABLE) || defined(RGB_MATRIX_ENABLE)) && defined(BAT_LEVEL_LED_LIST)
@@ -672,40 +592,18 @@ bool LED_INDICATORS_KB(void) {
 
         if (indicator_config.value) {
             uint8_t host_index = indicator_config.value & HOST_INDEX_MASK;
+            uint8_t host_led   = indicator_host_led();
+
+            if (host_led != NO_LED) sets[IND_LEDS_HOST] = (indicator_led_set_t){&host_led, 1};
 
             if (indicator_config.highlight) {
                 SET_ALL_LED_OFF();
             } else if (last_host_index != host_index) {
-#    ifdef P24G_INDICATION_LED_MATRIX_INDEX
-                if (indicator_config.value & HOST_P2P4G)
-                    SET_LED_OFF(P24G_INDICATION_LED_MATRIX_INDEX);
-                else
-#    endif
-#    ifdef BT_INDCATION_LED_MATRIX_LIST
-                    SET_LED_OFF(bt_ind_led_matrix_list[host_index - 1]);
-#    endif
+                if (host_led != NO_LED) SET_LED_OFF(host_led);
                 last_host_index = host_index;
             }
 
-            if (indicator_config.value & LED_ON) {
-#    ifdef P24G_INDICATION_LED_MATRIX_INDEX
-                if (indicator_config.value & HOST_P2P4G)
-                    SET_LED_P24G(P24G_INDICATION_LED_MATRIX_INDEX);
-                else
-#    endif
-#    ifdef BT_INDCATION_LED_MATRIX_LIST
-                    SET_LED_BT(bt_ind_led_matrix_list[host_index - 1]);
-#    endif
-            } else {
-#    ifdef P24G_INDICATION_LED_MATRIX_INDEX
-                if (indicator_config.value & HOST_P2P4G)
-                    SET_LED_OFF(P24G_INDICATION_LED_MATRIX_INDEX);
-                else
-#    endif
-#    ifdef BT_INDCATION_LED_MATRIX_LIST
-                    SET_LED_OFF(bt_ind_led_matrix_list[host_index - 1]);
-#    endif
-            }
+            indicator_player_render(&host_player, sets, (indicator_config.value & HOST_P2P4G) ? IND_COLOUR_GREEN : IND_COLOUR_BLUE);
         } else
             os_state_indicate();
 
@@ -18,25 +18,32 @@
 
 #include "config.h"
 #include "wireless.h"
+#include "indicator_pattern.h"
+
+/*
+ * Connection indications are (type, on_time, off_time, duration, highlight, value)
+ * tuples. INDICATOR_CONFIG() and INDICATOR_PATTERN_FROM_CONFIG() expand one into
+ * its indicator_config_t and into the flash pattern played on the host LED.
+ */
 
 /* Indication of pairing */
 #ifndef INDICATOR_CONFIG_PARING
-#    define INDICATOR_CONFIG_PARING {INDICATOR_BLINK, 1000, 1000, 0, true, 0};
+#    define INDICATOR_CONFIG_PARING (INDICATOR_BLINK, 1000, 1000, 0, true, 0)
 #endif
 
 /* Indication on Connected */
 #ifndef INDICATOR_CONFIG_CONNECTD
-#    define INDICATOR_CONFIG_CONNECTD {INDICATOR_ON_OFF, 2000, 250, 2000, true, 0};
+#    define INDICATOR_CONFIG_CONNECTD (INDICATOR_ON_OFF, 2000, 250, 2000, true, 0)
 #endif
 
 /* Reconnecting indication */
 #ifndef INDICATOR_CONFIG_RECONNECTING
-#    define INDICATOR_CONFIG_RECONNECTING {INDICATOR_BLINK, 100, 100, 600, true, 0};
+#    define INDICATOR_CONFIG_RECONNECTING (INDICATOR_BLINK, 100, 100, 600, true, 0)
 #endif
 
 /* Disconnected indication */
 #ifndef INDICATOR_CONFIG_DISCONNECTED
-#    define INDICATOR_CONFIG_DISCONNECTED {INDICATOR_NONE, 100, 100, 600, false, 0};
+#    define INDICATOR_CONFIG_DISCONNECTED (INDICATOR_NONE, 100, 100, 600, false, 0)
 #endif
 
 /* Uint: Second */
@@ -62,6 +69,28 @@
 #    define LOW_BAT_LED_TRIG_INTERVAL 30000
 #endif
 
+/* Low battery blink, see indicator_pattern.h */
+#ifndef INDICATOR_PATTERN_LOW_BAT
+// clang-format off
+#    define INDICATOR_PATTERN_LOW_BAT {.frames = {{LOW_BAT_LED_BLINK_PERIOD, IND_COLOUR_OFF, IND_LEDS_LOW_BAT}, {LOW_BAT_LED_BLINK_PERIOD, IND_COLOUR_RED, IND_LEDS_LOW_BAT}}, .count = 2, .repeat = LOW_BAT_LED_BLINK_TIMES}
+// clang-format on
+#endif
+
+// clang-format off
+#define INDICATOR_CONFIG_INIT(type, on, off, duration, highlight, value) {(type), (on), (off), (duration), (highlight), (value)}
+#define INDICATOR_CONFIG(config) INDICATOR_CONFIG_INIT config
+
+#define INDICATOR_ON_MS(type, on, duration) ((type) == INDICATOR_ON ? (duration) : (on))
+#define INDICATOR_OFF_MS(type, on, off, duration) ((type) == INDICATOR_ON_OFF ? ((duration) > (on) ? (duration) - (on) : 0) : (off))
+#define INDICATOR_FRAMES(type, on, duration) ((type) == INDICATOR_ON ? 1 : (type) == INDICATOR_ON_OFF ? ((duration) > (on) ? 2 : 1) : (type) == INDICATOR_BLINK ? 2 : 0)
+#define INDICATOR_BLINKS(on, off, duration) ((duration) / ((on) + (off) ? (on) + (off) : 1) + 1)
+#define INDICATOR_REPEAT(type, on, off, duration) ((type) != INDICATOR_BLINK ? 1 : (duration) == 0 || (on) + (off) == 0 ? 0 : INDICATOR_BLINKS(on, off, duration) > UINT8_MAX ? UINT8_MAX : INDICATOR_BLINKS(on, off, duration))
+#define INDICATOR_PATTERN_INIT(type, on, off, duration, highlight, value) \
+    {.frames = {{INDICATOR_ON_MS(type, on, duration), IND_COLOUR_HOST, IND_LEDS_HOST}, {INDICATOR_OFF_MS(type, on, off, duration), IND_COLOUR_OFF, IND_LEDS_HOST}}, \
+     .count = INDICATOR_FRAMES(type, on, duration), .repeat = INDICATOR_REPEAT(type, on, off, duration)}
+#define INDICATOR_PATTERN_FROM_CONFIG(config) INDICATOR_PATTERN_INIT config
+// clang-format on
+
 #if ((defined(LED_MATRIX_ENABLE) || defined(RGB_MATRIX_ENABLE)) && defined(LOW_BAT_IND_INDEX))
 #    define SPACE_KEY_LOW_BAT_IND
 #endif
@@ -111,4 +140,3 @@ bool indicator_is_enabled(void);
 bool indicator_is_running(void);
 void indicator_battery_low_enable(bool enable);
 
-void indicator_task(void);
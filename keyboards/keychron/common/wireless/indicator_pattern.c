@@ -0,0 +1,121 @@
+/* Copyright 2025 @ Keychron (https://www.keychron.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/******************************************************************************
+ *
+ *  Filename:      indicator_pattern.c
+ *
+ *  Description:   Plays indicator keyframe patterns on soft timers
+ *
+ ******************************************************************************/
+
+#include "quantum.h"
+#include "indicator_pattern.h"
+
+static void indicator_player_next(void *arg);
+
+static void indicator_player_finish(indicator_player_t *player) {
+    indicator_player_stop(player);
+    if (player->cb) player->cb(player);
+}
+
+static void indicator_player_enter(indicator_player_t *player) {
+    uint16_t duration = player->pattern->frames[player->frame].duration;
+
+    player->leds = player->pattern->frames[player->frame].leds;
+    if (duration) soft_timer_start(&player->timer, duration, indicator_player_next, player);
+    if (player->cb) player->cb(player);
+}
+
+static void indicator_player_next(void *arg) {
+    indicator_player_t *player = arg;
+
+    if (++player->frame >= player->pattern->count) {
+        player->frame = 0;
+        if (player->pattern->repeat && ++player->loop >= player->pattern->repeat) {
+            indicator_player_finish(player);
+            return;
+        }
+    }
+
+    indicator_player_enter(player);
+}
+
+void indicator_player_start(indicator_player_t *player, const indicator_pattern_t *pattern, indicator_player_cb_t cb) {
+    soft_timer_stop(&player->timer);
+    player->pattern = pattern;
+    player->frame   = 0;
+    player->loop    = 0;
+    player->cb      = cb;
+
+    if (pattern->count == 0) {
+        indicator_player_finish(player);
+        return;
+    }
+
+    indicator_player_enter(player);
+}
+
+void indicator_player_stop(indicator_player_t *player) {
+    soft_timer_stop(&player->timer);
+    player->pattern = NULL;
+}
+
+bool indicator_player_running(const indicator_player_t *player) {
+    return player->pattern;
+}
+
+uint8_t indicator_player_colour(const indicator_player_t *player) {
+    return player->pattern ? player->pattern->frames[player->frame].colour : IND_COLOUR_OFF;
+}
+
+/*
+ * Light the LED set of the current frame, from the LED matrix indicator
+ * callback. sets is indexed by indicator_leds_t. A stopped player blanks
+ * the set it showed last
+ */
+void indicator_player_render(const indicator_player_t *player, const indicator_led_set_t *sets, uint8_t host_colour) {
+    uint8_t colour = indicator_player_colour(player);
+
+    if (player->leds == IND_LEDS_NONE || player->leds >= IND_LEDS_MAX) return;
+    if (colour == IND_COLOUR_HOST) colour = host_colour == IND_COLOUR_HOST ? IND_COLOUR_BLUE : host_colour;
+
+    const indicator_led_set_t *set = &sets[player->leds];
+
+    for (uint8_t i = 0; i < set->count; i++) {
+#if defined(RGB_MATRIX_ENABLE)
+        switch (colour) {
+            case IND_COLOUR_BLUE:
+                rgb_matrix_set_color(set->leds[i], 0, 0, 255);
+                break;
+            case IND_COLOUR_WHITE:
+                rgb_matrix_set_color(set->leds[i], 255, 255, 255);
+                break;
+            case IND_COLOUR_RED:
+                rgb_matrix_set_color(set->leds[i], 255, 0, 0);
+                break;
+            case IND_COLOUR_GREEN:
+                rgb_matrix_set_color(set->leds[i], 0, 255, 0);
+                break;
+            default:
+                rgb_matrix_set_color(set->leds[i], 0, 0, 0);
+                break;
+        }
+#elif defined(LED_MATRIX_ENABLE)
+        led_matrix_set_value(set->leds[i], colour == IND_COLOUR_OFF ? 0 : 255);
+#endif
+    }
+}
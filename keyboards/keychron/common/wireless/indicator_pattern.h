@@ -0,0 +1,91 @@
+/* Copyright 2025 @ Keychron (https://www.keychron.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "soft_timer.h"
+
+#define INDICATOR_PATTERN_MAX_FRAMES 4
+
+/* Colours a frame can show, the LED set decides what COLOUR_HOST means */
+typedef enum {
+    IND_COLOUR_OFF,
+    IND_COLOUR_HOST, // Blue for Bluetooth, green for 2.4G
+    IND_COLOUR_WHITE,
+    IND_COLOUR_RED,
+    IND_COLOUR_GREEN,
+    IND_COLOUR_BLUE,
+} indicator_colour_t;
+
+/* LED sets a frame can light, mapped to LED indices by the caller of indicator_player_render() */
+typedef enum {
+    IND_LEDS_NONE,
+    IND_LEDS_HOST,    // Indicator LED of the current host
+    IND_LEDS_LOW_BAT, // LOW_BAT_IND_INDEX
+    IND_LEDS_MAX,
+} indicator_leds_t;
+
+typedef struct {
+    const uint8_t *leds;
+    uint8_t        count;
+} indicator_led_set_t;
+
+typedef struct {
+    uint16_t duration; // ms, 0 holds the frame until the pattern is stopped
+    uint8_t  colour;
+    uint8_t  leds;
+} indicator_frame_t;
+
+/*
+ * A pattern runs its frames in order, repeat times. A repeat of 0 runs
+ * until stopped. Patterns are plain const data, e.g.
+ *     INDICATOR_PATTERN_BLINK(IND_LEDS_LOW_BAT, IND_COLOUR_RED, 500, 500, 5)
+ */
+typedef struct {
+    indicator_frame_t frames[INDICATOR_PATTERN_MAX_FRAMES];
+    uint8_t           count;
+    uint8_t           repeat;
+} indicator_pattern_t;
+
+// clang-format off
+#define INDICATOR_PATTERN_NONE {.count = 0, .repeat = 1}
+#define INDICATOR_PATTERN_ON(leds, colour, ms) {.frames = {{(ms), (colour), (leds)}}, .count = 1, .repeat = 1}
+#define INDICATOR_PATTERN_ON_OFF(leds, colour, on, off) {.frames = {{(on), (colour), (leds)}, {(off), IND_COLOUR_OFF, (leds)}}, .count = 2, .repeat = 1}
+#define INDICATOR_PATTERN_BLINK(leds, colour, on, off, times) {.frames = {{(on), (colour), (leds)}, {(off), IND_COLOUR_OFF, (leds)}}, .count = 2, .repeat = (times)}
+// clang-format on
+
+typedef struct indicator_player indicator_player_t;
+
+/* Called on every frame change, and with pattern set to NULL when the
+ * pattern ends by itself. Not called by indicator_player_stop() */
+typedef void (*indicator_player_cb_t)(indicator_player_t *player);
+
+struct indicator_player {
+    const indicator_pattern_t *pattern;
+    uint8_t                    frame;
+    uint8_t                    loop;
+    uint8_t                    leds; // LED set of the last frame, blanked once stopped
+    soft_timer_t               timer;
+    indicator_player_cb_t      cb;
+};
+
+void    indicator_player_start(indicator_player_t *player, const indicator_pattern_t *pattern, indicator_player_cb_t cb);
+void    indicator_player_stop(indicator_player_t *player);
+bool    indicator_player_running(const indicator_player_t *player);
+uint8_t indicator_player_colour(const indicator_player_t *player);
+void    indicator_player_render(const indicator_player_t *player, const indicator_led_set_t *sets, uint8_t host_colour);
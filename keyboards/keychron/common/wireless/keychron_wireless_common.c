@@ -27,11 +27,16 @@
 #    include "keychron_task.h"
 #endif
 #include "keychron_common.h"
+#include "soft_timer.h"
 
 bool firstDisconnect = true;
 
-static uint32_t pairing_key_timer;
-static uint8_t  host_idx = 0;
+static soft_timer_t pairing_key_timer;
+static uint8_t      host_idx = 0;
+
+static void pairing_key_held(void *arg) {
+    wireless_pairing_ex(host_idx, NULL);
+}
 
 bool process_record_keychron_wireless(uint16_t keycode, keyrecord_t *record) {
     static uint8_t host_idx;
@@ -42,11 +47,11 @@ bool process_record_keychron_wireless(uint16_t keycode, keyrecord_t *record) {
                 if (record->event.pressed) {
                     host_idx = keycode - BT_HST1 + 1;
 
-                    pairing_key_timer = timer_read32();
+                    soft_timer_start(&pairing_key_timer, 2000, pairing_key_held, NULL);
                     wireless_connect_ex(host_idx, 0);
                 } else {
-                    host_idx          = 0;
-                    pairing_key_timer = 0;
+                    host_idx = 0;
+                    soft_timer_stop(&pairing_key_timer);
                 }
             }
             break;
@@ -55,10 +60,10 @@ bool process_record_keychron_wireless(uint16_t keycode, keyrecord_t *record) {
                 if (record->event.pressed) {
                     host_idx = P24G_INDEX;
 
-                    pairing_key_timer = timer_read32();
+                    soft_timer_start(&pairing_key_timer, 2000, pairing_key_held, NULL);
                 } else {
-                    host_idx          = 0;
-                    pairing_key_timer = 0;
+                    host_idx = 0;
+                    soft_timer_stop(&pairing_key_timer);
                 }
             }
             break;
@@ -110,15 +115,6 @@ void wireless_enter_disconnected_kb(uint8_t host_idx, uint8_t reason) {
     }
 }
 
-void keychron_wireless_common_task(void) {
-    if (pairing_key_timer) {
-        if (timer_elapsed32(pairing_key_timer) > 2000) {
-            pairing_key_timer = 0;
-            wireless_pairing_ex(host_idx, NULL);
-        }
-    }
-}
-
 void wireless_pre_task(void) {
     static uint8_t  dip_switch_state = 0;
     static uint32_t time = 0;
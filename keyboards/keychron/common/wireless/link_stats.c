@@ -0,0 +1,173 @@
+/* Copyright 2025 @ Keychron (https://www.keychron.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/******************************************************************************
+ *
+ *  Filename:      link_stats.c
+ *
+ *  Description:   Counters of the link to the wireless module, to tell a
+ *                 lost report from FIFO pressure or a dropped connection
+ *
+ ******************************************************************************/
+
+#include "quantum.h"
+#include "link_stats.h"
+
+static uint32_t frames_sent;
+static uint32_t acks[LINK_ACK_MAX];
+static uint32_t retries;
+static uint32_t enqueue_failed;
+static uint16_t queue_high_water;
+static uint16_t connects;
+static uint16_t disconnects;
+static uint16_t reconnects;
+
+static uint16_t latency_last;
+static uint16_t latency_min;
+static uint16_t latency_max;
+static uint32_t latency_sum;
+static uint16_t latency_count;
+
+static uint16_t interval_history[LINK_STATS_INTERVAL_HISTORY]; // 125 us units, newest first
+static uint8_t  interval_count;
+
+void link_stats_reset(void) {
+    frames_sent      = 0;
+    retries          = 0;
+    enqueue_failed   = 0;
+    queue_high_water = 0;
+    connects         = 0;
+    disconnects      = 0;
+    reconnects       = 0;
+    latency_last     = 0;
+    latency_min      = 0;
+    latency_max      = 0;
+    latency_sum      = 0;
+    latency_count    = 0;
+    interval_count   = 0;
+    memset(acks, 0, sizeof(acks));
+    memset(interval_history, 0, sizeof(interval_history));
+}
+
+void link_stats_frame_sent(void) {
+    frames_sent++;
+}
+
+void link_stats_ack(link_ack_t ack) {
+    if (ack < LINK_ACK_MAX) acks[ack]++;
+}
+
+void link_stats_retry(void) {
+    retries++;
+}
+
+void link_stats_queue_depth(uint16_t depth) {
+    if (depth > queue_high_water) queue_high_water = depth;
+}
+
+void link_stats_enqueue_failed(void) {
+    enqueue_failed++;
+}
+
+void link_stats_connected(void) {
+    connects++;
+}
+
+void link_stats_disconnected(void) {
+    disconnects++;
+}
+
+void link_stats_reconnecting(void) {
+    reconnects++;
+}
+
+void link_stats_interval(uint32_t interval_us) {
+    uint32_t units = interval_us / 125;
+
+    memmove(&interval_history[1], &interval_history[0], sizeof(interval_history) - sizeof(interval_history[0]));
+    interval_history[0] = units > UINT16_MAX ? UINT16_MAX : units;
+    if (interval_count < LINK_STATS_INTERVAL_HISTORY) interval_count++;
+}
+
+/* Time from a report first going out to its ack, retries included */
+void link_stats_latency(uint16_t ms) {
+    latency_last = ms;
+    if (!latency_count || ms < latency_min) latency_min = ms;
+    if (ms > latency_max) latency_max = ms;
+    latency_sum += ms;
+    latency_count++;
+
+    // Halve the sums instead of wrapping so the average keeps following the link
+    if (latency_count == UINT16_MAX) {
+        latency_sum /= 2;
+        latency_count /= 2;
+    }
+}
+
+static uint8_t put16(uint8_t *buf, uint16_t value) {
+    buf[0] = value & 0xFF;
+    buf[1] = value >> 8;
+    return 2;
+}
+
+static uint8_t put32(uint8_t *buf, uint32_t value) {
+    buf[0] = value & 0xFF;
+    buf[1] = (value >> 8) & 0xFF;
+    buf[2] = (value >> 16) & 0xFF;
+    buf[3] = (value >> 24) & 0xFF;
+    return 4;
+}
+
+/* Fill buf with one page of the counters, little endian. Returns the length used */
+uint8_t link_stats_get_report(uint8_t page, uint8_t *buf, uint8_t len) {
+    uint8_t i = 0;
+
+    switch (page) {
+        case LINK_PAGE_FRAMES:
+            if (len < 4 * (2 + LINK_ACK_MAX)) return 0;
+            i += put32(&buf[i], frames_sent);
+            i += put32(&buf[i], retries);
+            for (uint8_t a = 0; a < LINK_ACK_MAX; a++)
+                i += put32(&buf[i], acks[a]);
+            break;
+
+        case LINK_PAGE_QUEUE:
+            if (len < 22) return 0;
+            i += put32(&buf[i], enqueue_failed);
+            i += put16(&buf[i], queue_high_water);
+            i += put16(&buf[i], connects);
+            i += put16(&buf[i], disconnects);
+            i += put16(&buf[i], reconnects);
+            i += put16(&buf[i], latency_last);
+            i += put16(&buf[i], latency_min);
+            i += put16(&buf[i], latency_max);
+            i += put16(&buf[i], latency_count ? latency_sum / latency_count : 0);
+            i += put16(&buf[i], latency_count);
+            break;
+
+        case LINK_PAGE_INTERVAL:
+            buf[i++] = interval_count;
+            for (uint8_t n = 0; n < interval_count && i + 2 <= len; n++)
+                i += put16(&buf[i], interval_history[n]);
+            break;
+
+        case LINK_PAGE_RESET:
+            link_stats_reset();
+            break;
+    }
+
+    return i;
+}
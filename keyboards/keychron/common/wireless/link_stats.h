@@ -0,0 +1,52 @@
+/* Copyright 2025 @ Keychron (https://www.keychron.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/* Number of connection intervals reported by the module that are kept */
+#ifndef LINK_STATS_INTERVAL_HISTORY
+#    define LINK_STATS_INTERVAL_HISTORY 12
+#endif
+
+typedef enum {
+    LINK_ACK_SUCCESS,
+    LINK_ACK_CHECKSUM_ERROR,
+    LINK_ACK_FIFO_HALF_WARNING,
+    LINK_ACK_FIFO_FULL_ERROR,
+    LINK_ACK_TIMEOUT,
+    LINK_ACK_MAX,
+} link_ack_t;
+
+enum {
+    LINK_PAGE_FRAMES,
+    LINK_PAGE_QUEUE,
+    LINK_PAGE_INTERVAL,
+    LINK_PAGE_RESET = 0xFF,
+};
+
+void link_stats_reset(void);
+void link_stats_frame_sent(void);
+void link_stats_ack(link_ack_t ack);
+void link_stats_retry(void);
+void link_stats_queue_depth(uint16_t depth);
+void link_stats_enqueue_failed(void);
+void link_stats_connected(void);
+void link_stats_disconnected(void);
+void link_stats_reconnecting(void);
+void link_stats_interval(uint32_t interval_us);
+void link_stats_latency(uint16_t ms);
+
+uint8_t link_stats_get_report(uint8_t page, uint8_t *buf, uint8_t len);
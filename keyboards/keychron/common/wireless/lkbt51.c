@@ -21,7 +21,12 @@
 #include "battery.h"
 #include "raw_hid.h"
 #include "report_buffer.h"
+#include "link_stats.h"
+#include "trace.h"
+#include "profiler.h"
+#include "loop_monitor.h"
 #include "factory_test.h"
+#include "energy.h"
 
 extern void factory_test_send(uint8_t* payload, uint8_t length);
 
@@ -147,7 +152,10 @@ static uint8_t  reg_offset          = 0xFF;
 static uint8_t  expect_len          = 22;
 static uint16_t connection_interval = 1;
 static uint32_t wake_time;
-static uint32_t factory_reset = 0;
+static uint32_t factory_reset  = 0;
+static bool     nkro_keys_sent = false; // NKRO report may hold keys
+static bool     kb_keys_sent   = false; // 6KRO report may hold keys
+static uint8_t  cmd_sn         = 0;
 
 // clang-format off
 wt_func_t wireless_transport = {
@@ -161,7 +169,8 @@ wt_func_t wireless_transport = {
     lkbt51_send_system,
     lkbt51_send_mouse,
     lkbt51_update_bat_lvl,
-    lkbt51_task
+    lkbt51_task,
+    lkbt51_last_sn
 };
 // clang-format on
 
@@ -225,10 +234,12 @@ static inline void lkbt51_wake(void) {
     if (timer_elapsed32(wake_time) > 3000) {
         wake_time = timer_read32();
 
+        loop_monitor_block_begin(LOOP_SITE_LKBT51_WAKE);
         palWriteLine(LKBT51_INT_OUTPUT_PIN, 0);
         wait_ms(10);
         palWriteLine(LKBT51_INT_OUTPUT_PIN, 1);
         wait_ms(300);
+        loop_monitor_block_end();
     }
 }
 
@@ -251,6 +262,8 @@ void lkbt51_send_protocol_ver(uint16_t ver) {
 
 #if HAL_USE_SPI
     expect_len = 10;
+    energy_spi_transfer();
+    link_stats_frame_sent();
     spiStart(&WT_DRIVER, &spicfg);
     spiSelect(&WT_DRIVER);
     spiSend(&WT_DRIVER, i, pkt);
@@ -259,14 +272,17 @@ void lkbt51_send_protocol_ver(uint16_t ver) {
 #endif
 }
 
+uint8_t lkbt51_last_sn(void) {
+    return cmd_sn;
+}
+
 void lkbt51_send_cmd(uint8_t* payload, uint8_t len, bool ack_enable, bool retry) {
-    static uint8_t sn = 0;
-    uint8_t        i;
-    uint8_t        pkt[PACKET_MAX_LEN] = {0};
+    uint8_t i;
+    uint8_t pkt[PACKET_MAX_LEN] = {0};
     memset(pkt, 0, PACKET_MAX_LEN);
 
-    if (!retry) ++sn;
-    if (sn == 0) ++sn;
+    if (!retry) ++cmd_sn;
+    if (cmd_sn == 0) ++cmd_sn;
 
     uint16_t checksum = 0;
     for (i = 0; i < len; i++)
@@ -281,7 +297,7 @@ void lkbt51_send_cmd(uint8_t* payload, uint8_t len, bool ack_enable, bool retry)
     pkt[i++] = ack_enable ? 0x56 : 0x55;
     pkt[i++] = len + 2;
     pkt[i++] = ~(len + 2) & 0xFF;
-    pkt[i++] = sn;
+    pkt[i++] = cmd_sn;
 
     memcpy(pkt + i, payload, len);
     i += len;
@@ -293,6 +309,8 @@ void lkbt51_send_cmd(uint8_t* payload, uint8_t len, bool ack_enable, bool retry)
     else
         expect_len = 64;
 
+    energy_spi_transfer();
+    link_stats_frame_sent();
     spiStart(&WT_DRIVER, &spicfg);
     spiSelect(&WT_DRIVER);
     spiSend(&WT_DRIVER, i, pkt);
@@ -315,6 +333,7 @@ void lkbt51_read(uint8_t* payload, uint8_t len) {
     i += len;
 
 #if HAL_USE_SPI
+    energy_spi_transfer();
     spiStart(&WT_DRIVER, &spicfg);
     spiSelect(&WT_DRIVER);
     spiExchange(&WT_DRIVER, i, pkt, payload);
@@ -334,17 +353,69 @@ void lkbt51_send_keyboard(uint8_t* report) {
     lkbt51_send_cmd(payload, i, true, false);
 }
 
-void lkbt51_send_nkro(uint8_t* report) {
+static void lkbt51_send_nkro_frame(uint8_t* report) {
     uint8_t i = 0;
     memset(payload, 0, PACKET_MAX_LEN);
 
     payload[i++] = LKBT51_CMD_SEND_KB_NKRO;
-    memcpy(payload + i, report, 20); // NKRO report lenght is limited to 20 bytes
-    i += 20;
+    if (report) memcpy(payload + i, report, NKRO_PAYLOAD_LEN);
+    i += NKRO_PAYLOAD_LEN;
 
     lkbt51_send_cmd(payload, i, true, false);
 }
 
+/* Put up to 6 keycodes of the NKRO bitmap from byte start on into the key
+ * slots of kb. Returns the number of keys held, which may be more than 6 */
+static uint8_t nkro_collect_keys(uint8_t* report, uint8_t start, uint8_t* kb) {
+    uint8_t count = 0;
+
+    for (uint8_t b = start; b < NKRO_REPORT_BITS; b++) {
+        uint8_t bits = report[1 + b];
+
+        for (uint8_t j = 0; bits; j++, bits >>= 1) {
+            if (!(bits & 0x01)) continue;
+            if (count < 6) kb[2 + count] = b * 8 + j;
+            count++;
+        }
+    }
+
+    return count;
+}
+
+/* The module only takes the modifiers and the first NKRO_PAYLOAD_LEN - 1
+ * bitmap bytes of a NKRO report. Keys past that window are carried by the
+ * 6KRO report instead, which the host merges with the NKRO one.
+ * With APDAPTIVE_NKRO_ENABLE the shorter 6KRO report is used alone while
+ * six keys or less are held. On a switch the new report is always sent
+ * before the old one is cleared, so the host never sees a key released */
+void lkbt51_send_nkro(uint8_t* report) {
+    uint8_t kb[8] = {0};
+
+#ifdef APDAPTIVE_NKRO_ENABLE
+    if (nkro_collect_keys(report, 0, kb) <= 6) {
+        kb[0] = report[0];
+        lkbt51_send_keyboard(kb);
+        kb_keys_sent = true;
+
+        if (nkro_keys_sent) {
+            lkbt51_send_nkro_frame(NULL);
+            nkro_keys_sent = false;
+        }
+        return;
+    }
+    memset(kb, 0, sizeof(kb));
+#endif
+
+    lkbt51_send_nkro_frame(report);
+    nkro_keys_sent = true;
+
+    uint8_t overflow = nkro_collect_keys(report, NKRO_PAYLOAD_LEN - 1, kb);
+    if (overflow || kb_keys_sent) {
+        kb_keys_sent = overflow > 0;
+        lkbt51_send_keyboard(kb);
+    }
+}
+
 void lkbt51_send_consumer(uint16_t report) {
     uint8_t i = 0;
     memset(payload, 0, PACKET_MAX_LEN);
@@ -360,13 +431,14 @@ void lkbt51_send_consumer(uint16_t report) {
 void lkbt51_send_system(uint16_t report) {
     uint8_t hid_usage = report & 0xFF;
 
-    if (hid_usage < 0x81 || hid_usage > 0x83) return;
+    // Usage 0 releases the key, it is queued and acked like any other report
+    if (hid_usage && (hid_usage < 0x81 || hid_usage > 0x83)) return;
 
     uint8_t i = 0;
     memset(payload, 0, PACKET_MAX_LEN);
 
     payload[i++] = LKBT51_CMD_SEND_SYSTEM;
-    payload[i++] = 0x01 << (hid_usage - 0x81);
+    payload[i++] = hid_usage ? 0x01 << (hid_usage - 0x81) : 0;
 
     lkbt51_send_cmd(payload, i, true, false);
 }
@@ -448,9 +520,11 @@ void lkbt51_disconnect(void) {
     if (WT_DRIVER.state != SPI_READY)
         spiStart(&WT_DRIVER, &spicfg);
     spiSelect(&WT_DRIVER);
+    loop_monitor_block_begin(LOOP_SITE_LKBT51_DISCONNECT);
     wait_ms(30);
     // spiUnselect(&SPID1);
     wait_ms(70);
+    loop_monitor_block_end();
 
     lkbt51_send_cmd(payload, i, true, false);
 }
@@ -585,6 +659,7 @@ bool lkbt51_read_customize_data(uint8_t* data, uint8_t len) {
     buf[i++] = 0x80;
 
 #if HAL_USE_SPI
+    energy_spi_transfer();
     spiStart(&WT_DRIVER, &spicfg);
     spiSelect(&WT_DRIVER);
     spiExchange(&WT_DRIVER, 20, buf, payload);
@@ -608,6 +683,7 @@ void lkbt51_write_customize_data(uint8_t* data, uint8_t len) {
     pkt[i++] = 0x00;
 
 #if HAL_USE_SPI
+    energy_spi_transfer();
     spiStart(&WT_DRIVER, &spicfg);
     spiSelect(&WT_DRIVER);
     spiSend(&WT_DRIVER, i, pkt);
@@ -684,28 +760,49 @@ void lkbt51_dfu_rx(uint8_t* data, uint8_t length) {
     }
 }
 
+/* data[1] is the command of the acked frame, data[2] the ack code. The
+ * report buffer keeps one unacked report per class in flight, so the
+ * command alone tells which report the ack belongs to */
 static void ack_handler(uint8_t* data, uint8_t len) {
+    uint8_t type;
+
     switch (data[1]) {
         case LKBT51_CMD_SEND_KB:
         case LKBT51_CMD_SEND_KB_NKRO:
+            type = REPORT_TYPE_KB;
+            break;
         case LKBT51_CMD_SEND_CONSUMER:
+            type = REPORT_TYPE_CONSUMER;
+            break;
         case LKBT51_CMD_SEND_SYSTEM:
+            type = REPORT_TYPE_SYSTEM;
+            break;
         case LKBT51_CMD_SEND_MOUSE:
-            switch (data[2]) {
-                case ACK_SUCCESS:
-                    report_buffer_set_retry(0);
-                    report_buffer_set_inverval(connection_interval);
-                    break;
-                case ACK_FIFO_HALF_WARNING:
-                    report_buffer_set_retry(0);
-                    report_buffer_set_inverval(connection_interval + 5);
-                    break;
-                case ACK_FIFO_FULL_ERROR:
-                    report_buffer_set_inverval(connection_interval + 10);
-                    break;
-            }
+            type = REPORT_TYPE_MOUSE;
             break;
         default:
+            return;
+    }
+
+    switch (data[2]) {
+        case ACK_SUCCESS:
+            link_stats_ack(LINK_ACK_SUCCESS);
+            report_buffer_ack(type, true);
+            report_buffer_set_inverval(connection_interval);
+            break;
+        case ACK_CHECKSUM_ERROR:
+            link_stats_ack(LINK_ACK_CHECKSUM_ERROR);
+            report_buffer_ack(type, false);
+            break;
+        case ACK_FIFO_HALF_WARNING:
+            link_stats_ack(LINK_ACK_FIFO_HALF_WARNING);
+            report_buffer_ack(type, true);
+            report_buffer_set_inverval(connection_interval + 5);
+            break;
+        case ACK_FIFO_FULL_ERROR:
+            link_stats_ack(LINK_ACK_FIFO_FULL_ERROR);
+            report_buffer_ack(type, false);
+            report_buffer_set_inverval(connection_interval + 10);
             break;
     }
 }
@@ -725,38 +822,34 @@ static void query_rsp_handler(uint8_t* data, uint8_t len) {
 static void lkbt51_event_handler(uint8_t evt_type, uint8_t* data, uint8_t len, uint8_t sn) {
     wireless_event_t event = {0};
 
+    // Acks come with every report and would flush everything else out of the trace
+    if (evt_type != LKBT51_EVT_ACK) trace_event(TRACE_LKBT51_EVENT, evt_type, len ? data[0] : 0);
+
     switch (evt_type) {
         case LKBT51_EVT_ACK:
             ack_handler(data, len);
             break;
         case LKBT51_EVT_RESET:
-            kc_printf("LKBT51_EVT_RESET\n");
             event.evt_type      = EVT_RESET;
             event.params.reason = data[0];
             break;
         case LKBT51_EVT_LE_CONNECTION:
-            kc_printf("LKBT51_EVT_LE_CONNECTION\n");
             break;
         case LKBT51_EVT_HOST_TYPE:
-            kc_printf("LKBT51_EVT_HOST_TYPE\n");
             break;
         case LKBT51_EVT_HID_EVENT:
-            kc_printf("LKBT51_EVT_HID_EVENT\n");
             event.evt_type   = EVT_HID_INDICATOR;
             event.params.led = data[0];
             break;
         case LKBT51_EVT_QUERY_RSP:
-            kc_printf("LKBT51_EVT_QUERY_RSP\n\r");
             query_rsp_handler(data, len);
             break;
         case LKBT51_EVT_OTA_RSP:
 #ifdef RAW_ENABLE
-            kc_printf("LKBT51_EVT_OTA_RSP\n");
             lkbt51_dfu_tx(LKBT51_EVT_OTA_RSP, data, len, sn);
 #endif
             break;
         default:
-            kc_printf("Unknown event!!!\n");
             break;
     }
 
@@ -764,6 +857,8 @@ static void lkbt51_event_handler(uint8_t evt_type, uint8_t* data, uint8_t len, u
 }
 
 void lkbt51_task(void) {
+    PROFILE_SCOPE(PROFILE_LKBT51);
+
 #define VALID_DATA_START_INDEX 4
 #define BUFFER_SIZE 64
 
@@ -779,8 +874,7 @@ void lkbt51_task(void) {
 
         if (pbuf[0] == 0xAA && pbuf[1] == 0x54 && pbuf[4] == (uint8_t)(~0x54) && pbuf[5] == (uint8_t)(~0xAA)) {
             uint16_t protol_ver = pbuf[3] << 8 | pbuf[2];
-            kc_printf("protol_ver: %x\n\r", protol_ver);
-            (void)protol_ver;
+            trace_event(TRACE_LKBT51_PROTOCOL_VER, 0, protol_ver);
         } else if (pbuf[0] == 0xAA) {
             wireless_event_t event    = {0};
             uint8_t          evt_mask = pbuf[1];
@@ -839,6 +933,7 @@ void lkbt51_task(void) {
                 } else {
                     interval = (pbuf[8] & 0x7F) * 125;
                 }
+                link_stats_interval(interval);
 
                 connection_interval = interval / 1000;
                 if (connection_interval > 7) connection_interval /= 3;
@@ -41,6 +41,7 @@
 #define BDA_LEN 6
 #define PACKET_MAX_LEN 64
 #define P24G_INDEX 24
+#define NKRO_PAYLOAD_LEN 20 // Modifiers and bitmap bytes of a NKRO report the module accepts
 
 enum {
     PAIRING_MODE_DEFAULT = 0x00,
@@ -103,7 +104,8 @@ typedef struct {
 void lkbt51_init(bool wakeup_from_low_power_mode);
 void lkbt51_send_protocol_ver(uint16_t ver);
 
-void lkbt51_send_cmd(uint8_t* payload, uint8_t len, bool ack_enable, bool retry);
+void    lkbt51_send_cmd(uint8_t* payload, uint8_t len, bool ack_enable, bool retry);
+uint8_t lkbt51_last_sn(void);
 
 void lkbt51_send_keyboard(uint8_t* report);
 void lkbt51_send_nkro(uint8_t* report);
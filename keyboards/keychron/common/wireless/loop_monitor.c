@@ -0,0 +1,168 @@
+/* Copyright 2025 @ Keychron (https://www.keychron.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/******************************************************************************
+ *
+ *  Filename:      loop_monitor.c
+ *
+ *  Description:   Histogram of the main loop tick durations and a log of the
+ *                 stalls, blamed on the blocking call site that caused them
+ *
+ ******************************************************************************/
+
+#include "quantum.h"
+#include "loop_monitor.h"
+
+typedef struct {
+    uint32_t time;
+    uint16_t ms;
+    uint8_t  site;
+} loop_stall_t;
+
+static uint32_t     histogram[LOOP_MONITOR_BUCKETS];
+static uint16_t     site_count[LOOP_SITE_MAX];
+static uint16_t     site_max[LOOP_SITE_MAX];
+static loop_stall_t stalls[LOOP_MONITOR_STALL_LOG]; // Newest first
+
+static uint32_t tick_start  = 0;
+static bool     tick_valid  = false;
+static uint8_t  tick_site   = LOOP_SITE_NONE; // Site that blocked longest in this tick
+static uint16_t tick_block  = 0;
+static uint32_t tick_idle   = 0; // Time spent idling on purpose in this tick
+static uint8_t  block_site  = LOOP_SITE_NONE;
+static uint8_t  block_depth = 0;
+static uint32_t block_start = 0;
+
+static bool loop_site_is_idle(uint8_t site) {
+    return site == LOOP_SITE_LPM_THROTTLE || site == LOOP_SITE_LPM_STANDBY || site == LOOP_SITE_USB_SUSPEND;
+}
+
+static uint8_t loop_bucket(uint32_t ms) {
+    uint8_t bucket = 0;
+
+    while (ms && bucket < LOOP_MONITOR_BUCKETS - 1) {
+        ms >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+/* Called once per main loop */
+void loop_monitor_task(void) {
+    uint32_t now = timer_read32();
+
+    if (tick_valid) {
+        uint32_t ms = TIMER_DIFF_32(now, tick_start);
+
+        ms = ms > tick_idle ? ms - tick_idle : 0;
+        histogram[loop_bucket(ms)]++;
+
+        if (ms >= LOOP_MONITOR_STALL_MS) {
+            memmove(&stalls[1], &stalls[0], sizeof(stalls) - sizeof(stalls[0]));
+            stalls[0].time = tick_start;
+            stalls[0].ms   = ms > UINT16_MAX ? UINT16_MAX : ms;
+            stalls[0].site = tick_site;
+        }
+    }
+
+    tick_start = now;
+    tick_valid = true;
+    tick_site  = LOOP_SITE_NONE;
+    tick_block = 0;
+    tick_idle  = 0;
+}
+
+/* Bracket a call that blocks the main loop. Nested blocks are counted as
+ * part of the outermost one */
+void loop_monitor_block_begin(uint8_t site) {
+    if (block_depth++) return;
+
+    block_site  = site;
+    block_start = timer_read32();
+}
+
+void loop_monitor_block_end(void) {
+    if (!block_depth || --block_depth) return;
+
+    uint32_t ms   = timer_elapsed32(block_start);
+    uint16_t ms16 = ms > UINT16_MAX ? UINT16_MAX : ms;
+
+    if (block_site >= LOOP_SITE_MAX) return;
+
+    if (site_count[block_site] < UINT16_MAX) site_count[block_site]++;
+    if (ms16 > site_max[block_site]) site_max[block_site] = ms16;
+
+    if (loop_site_is_idle(block_site)) {
+        tick_idle += ms;
+    } else if (ms16 >= tick_block) {
+        tick_block = ms16;
+        tick_site  = block_site;
+    }
+}
+
+void loop_monitor_reset(void) {
+    memset(histogram, 0, sizeof(histogram));
+    memset(site_count, 0, sizeof(site_count));
+    memset(site_max, 0, sizeof(site_max));
+    memset(stalls, 0, sizeof(stalls));
+    tick_valid = false;
+}
+
+/* Fill buf with one page of the statistics, little endian. Returns the length used */
+uint8_t loop_monitor_get_report(uint8_t page, uint8_t *buf, uint8_t len) {
+    uint8_t i = 0;
+
+    switch (page) {
+        case LOOP_PAGE_HISTOGRAM:
+            for (uint8_t b = 0; b < LOOP_MONITOR_BUCKETS && i + 4 <= len; b++) {
+                buf[i++] = histogram[b] & 0xFF;
+                buf[i++] = (histogram[b] >> 8) & 0xFF;
+                buf[i++] = (histogram[b] >> 16) & 0xFF;
+                buf[i++] = (histogram[b] >> 24) & 0xFF;
+            }
+            break;
+
+        // Times blocked and longest block in ms of each site from LOOP_SITE_NONE + 1 on
+        case LOOP_PAGE_SITES:
+            for (uint8_t s = LOOP_SITE_NONE + 1; s < LOOP_SITE_MAX && i + 4 <= len; s++) {
+                buf[i++] = site_count[s] & 0xFF;
+                buf[i++] = site_count[s] >> 8;
+                buf[i++] = site_max[s] & 0xFF;
+                buf[i++] = site_max[s] >> 8;
+            }
+            break;
+
+        // Start time, duration in ms and site of the latest stalls
+        case LOOP_PAGE_STALLS:
+            for (uint8_t n = 0; n < LOOP_MONITOR_STALL_LOG && i + 7 <= len; n++) {
+                buf[i++] = stalls[n].time & 0xFF;
+                buf[i++] = (stalls[n].time >> 8) & 0xFF;
+                buf[i++] = (stalls[n].time >> 16) & 0xFF;
+                buf[i++] = (stalls[n].time >> 24) & 0xFF;
+                buf[i++] = stalls[n].ms & 0xFF;
+                buf[i++] = stalls[n].ms >> 8;
+                buf[i++] = stalls[n].site;
+            }
+            break;
+
+        case LOOP_PAGE_RESET:
+            loop_monitor_reset();
+            break;
+    }
+
+    return i;
+}
@@ -0,0 +1,61 @@
+/* Copyright 2025 @ Keychron (https://www.keychron.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* A main loop tick taking this long or more is logged as a stall */
+#ifndef LOOP_MONITOR_STALL_MS
+#    define LOOP_MONITOR_STALL_MS 20
+#endif
+
+#ifndef LOOP_MONITOR_STALL_LOG
+#    define LOOP_MONITOR_STALL_LOG 4
+#endif
+
+/* Call sites known to block the main loop. Time spent in the LPM sites and
+ * waiting out a host suspend is deliberate idling, it is taken off the tick
+ * before it is counted */
+enum {
+    LOOP_SITE_NONE,
+    LOOP_SITE_LKBT51_WAKE,
+    LOOP_SITE_LKBT51_DISCONNECT,
+    LOOP_SITE_TRANSPORT_ENABLE,
+    LOOP_SITE_LOW_BAT_SHUTDOWN,
+    LOOP_SITE_USB_REMOTE_WAKEUP,
+    LOOP_SITE_LPM_THROTTLE,
+    LOOP_SITE_LPM_STANDBY,
+    LOOP_SITE_USB_SUSPEND,
+    LOOP_SITE_MAX,
+};
+
+/* Tick durations are counted in power of two ms buckets: 0, 1, 2-3, 4-7,
+ * 8-15, 16-31 and 32 ms or more */
+#define LOOP_MONITOR_BUCKETS 7
+
+enum {
+    LOOP_PAGE_HISTOGRAM,
+    LOOP_PAGE_SITES,
+    LOOP_PAGE_STALLS,
+    LOOP_PAGE_RESET = 0xFF,
+};
+
+void    loop_monitor_task(void);
+void    loop_monitor_block_begin(uint8_t site);
+void    loop_monitor_block_end(void);
+void    loop_monitor_reset(void);
+uint8_t loop_monitor_get_report(uint8_t page, uint8_t *buf, uint8_t len);
@@ -33,13 +33,53 @@
 #include "transport.h"
 #include "battery.h"
 #include "report_buffer.h"
+#include "energy.h"
+#include "rtc_timer.h"
 #include "keychron_common.h"
+#include "soft_timer.h"
+#include "profiler.h"
+#include "loop_monitor.h"
 
 extern matrix_row_t matrix[MATRIX_ROWS];
 extern wt_func_t    wireless_transport;
 
 static uint32_t lpm_timer_buffer;
-static bool     lpm_time_up = false;
+static bool     lpm_timer_running = false;
+
+static const lpm_stage_t lpm_stages[] = LPM_STAGES;
+#define LPM_STAGE_COUNT (sizeof(lpm_stages) / sizeof(lpm_stages[0]))
+
+static uint8_t  lpm_stage = LPM_STAGE_NONE;
+static uint16_t stage_latency[LPM_STAGE_COUNT];     // Learned wake latency, ms
+static uint8_t  stage_dwell_scale[LPM_STAGE_COUNT]; // Dwell multiplier learned from short stays
+static uint16_t stage_entries[LPM_STAGE_COUNT];
+static uint16_t stage_short_stays[LPM_STAGE_COUNT]; // Left before LPM_MIN_RESIDENCY_MS
+static uint32_t latency_decay_timer = 0;
+static uint32_t standby_entries = 0;
+static uint32_t standby_exits   = 0;
+
+/* Wake to first report latency, measured from clock restore */
+static bool     wake_pending = false;
+static uint32_t wake_timer   = 0;
+static uint16_t wake_latency_last;
+static uint16_t wake_latency_min = UINT16_MAX;
+static uint16_t wake_latency_max;
+static uint32_t wake_latency_sum;
+static uint16_t wake_latency_count;
+
+/* Keys found pressed when the MCU left stop mode, replayed if the matrix
+ * scan misses them */
+static uint32_t wake_rows = 0;
+static keypos_t wake_keys[LPM_WAKE_KEY_MAX];
+static uint8_t  wake_key_count = 0;
+static uint8_t  wake_key_seen  = 0;
+static uint8_t  wake_replay_scans;
+static uint32_t wake_replay_timer;
+#ifdef DEBOUNCE
+#    define LPM_WAKE_DEBOUNCE_MS DEBOUNCE
+#else
+#    define LPM_WAKE_DEBOUNCE_MS 5 // QMK's default
+#endif
 #ifndef OPTICAL_SWITCH
 static matrix_row_t empty_matrix[MATRIX_ROWS] = {0};
 #endif
@@ -69,13 +109,19 @@ void lpm_init(void) {
 }
 
 inline void lpm_timer_reset(void) {
-    lpm_time_up      = false;
-    lpm_timer_buffer = timer_read32();
+    lpm_timer_running = true;
+    lpm_timer_buffer  = timer_read32();
+    lpm_stage         = LPM_STAGE_NONE;
 }
 
 void lpm_timer_stop(void) {
-    lpm_time_up      = false;
-    lpm_timer_buffer = 0;
+    lpm_timer_running = false;
+    lpm_timer_buffer  = 0;
+    lpm_stage         = LPM_STAGE_NONE;
+}
+
+uint8_t lpm_get_stage(void) {
+    return lpm_stage;
 }
 
 static inline bool lpm_any_matrix_action(void) {
@@ -102,6 +148,211 @@ __attribute__((weak)) void matrix_exit_low_power(void) {
     }
 }
 
+__attribute__((weak)) void unselect_all_cols(void) {
+    for (uint8_t i = 0; i < MATRIX_COLS; i++) {
+        if (pins_col[i] != NO_PIN) gpio_set_pin_input_high(pins_col[i]);
+    }
+}
+
+static uint32_t read_active_rows(void) {
+    uint32_t rows = 0;
+
+    for (uint8_t x = 0; x < MATRIX_ROWS; x++) {
+        if (pins_row[x] != NO_PIN && gpio_read_pin(pins_row[x]) == 0) rows |= 0x01UL << x;
+    }
+
+    return rows;
+}
+
+/* Check for a pressed key without a full scan, for matrices driving the
+ * columns and reading the rows */
+__attribute__((weak)) bool lpm_matrix_peek(void) {
+    bool pressed;
+
+    select_all_cols();
+    wait_us(1);
+    pressed = read_active_rows() != 0;
+    unselect_all_cols();
+
+    return pressed;
+}
+
+static void lpm_sleep_timeout(virtual_timer_t *vtp, void *arg) {}
+
+/* Sleep the core for up to `period` ms between scans. The columns stay
+ * driven and the rows armed as for stop mode, so a key press ends the WFI
+ * at once and a virtual timer ends it on time. Clocks and peripherals keep
+ * running, so nothing needs restoring. Returns whether a key is pressed */
+__attribute__((weak)) bool lpm_sleep(uint16_t period) {
+    virtual_timer_t vt;
+    uint32_t        start = timer_read32();
+    bool            pressed;
+
+    chVTObjectInit(&vt);
+    chVTSet(&vt, TIME_MS2I(period), lpm_sleep_timeout, NULL);
+    matrix_enter_low_power();
+    wait_us(1);
+
+    while (true) {
+        // With interrupts masked an event between the check and WFI still ends the WFI
+        __disable_irq();
+        pressed = read_active_rows() != 0;
+        if (pressed || timer_elapsed32(start) >= period) break;
+        __WFI();
+        __enable_irq();
+    }
+    __enable_irq();
+
+    chVTReset(&vt);
+    matrix_exit_low_power();
+    unselect_all_cols();
+
+    return pressed;
+}
+
+/* Called by lpm_standby() right after the MCU wakes, while all columns are
+ * still driven, so a short tap that woke it is seen before it is released.
+ * This runs before the clocks are restored, and on WB32 with the kernel
+ * still disabled, so only plain GPIO access and busy loops are allowed */
+void lpm_capture_wake_rows(void) {
+    wake_rows      = read_active_rows();
+    wake_key_count = 0;
+    wake_key_seen  = 0;
+    if (!wake_rows) return;
+
+    /* Drive one column at a time to find the keys. Every column is probed
+     * in order, as shift register columns can only be selected that way */
+    unselect_all_cols();
+    for (uint8_t col = 0; col < MATRIX_COLS; col++) {
+        uint32_t rows = lpm_probe_col(col) & wake_rows;
+
+        for (uint8_t row = 0; rows && wake_key_count < LPM_WAKE_KEY_MAX; row++, rows >>= 1) {
+            if (rows & 0x01) wake_keys[wake_key_count++] = (keypos_t){.row = row, .col = col};
+        }
+    }
+    select_all_cols();
+}
+
+/* Let a column settle before the rows are read. A NOP loop works on the
+ * wake up clock and without interrupts, unlike the system timer; it only
+ * gets longer on the slower clock */
+static inline void lpm_settle_delay(void) {
+    for (uint8_t i = 0; i < LPM_SETTLE_NOPS; i++)
+        asm volatile("nop" ::: "memory");
+}
+
+/* Read the rows with a single column driven low */
+__attribute__((weak)) uint32_t lpm_probe_col(uint8_t col) {
+    uint32_t rows;
+
+    if (pins_col[col] == NO_PIN) return 0;
+
+    gpio_set_pin_output_push_pull(pins_col[col]);
+    gpio_write_pin_low(pins_col[col]);
+    lpm_settle_delay();
+    rows = read_active_rows();
+    gpio_set_pin_input_high(pins_col[col]);
+
+    return rows;
+}
+
+/* A key tapped to wake the board can be released before the first scan
+ * after wake up. Replay it as a tap if the matrix never saw it pressed.
+ * A key still held only shows up once debounce lets it through, so give
+ * the matrix the debounce time and a few scans before deciding */
+static void lpm_wake_replay_task(void) {
+    if (!wake_key_count) return;
+
+    for (uint8_t i = 0; i < wake_key_count; i++) {
+        if (matrix_is_on(wake_keys[i].row, wake_keys[i].col)) wake_key_seen |= 0x01 << i;
+    }
+
+    if (wake_replay_scans < LPM_WAKE_REPLAY_SCANS) wake_replay_scans++;
+    if (wake_replay_scans < LPM_WAKE_REPLAY_SCANS || timer_elapsed32(wake_replay_timer) < LPM_WAKE_DEBOUNCE_MS + LPM_WAKE_REPLAY_MS) return;
+
+    for (uint8_t i = 0; i < wake_key_count; i++) {
+        if (wake_key_seen & (0x01 << i)) continue;
+
+        action_exec(MAKE_KEYEVENT(wake_keys[i].row, wake_keys[i].col, true));
+        action_exec(MAKE_KEYEVENT(wake_keys[i].row, wake_keys[i].col, false));
+    }
+    wake_key_count = 0;
+}
+
+uint32_t lpm_get_wake_rows(void) {
+    return wake_rows;
+}
+
+void lpm_report_sent(void) {
+    if (!wake_pending) return;
+
+    uint32_t latency = timer_elapsed32(wake_timer);
+    if (latency > UINT16_MAX) latency = UINT16_MAX;
+
+    wake_pending      = false;
+    wake_latency_last = latency;
+    wake_latency_sum += latency;
+    wake_latency_count++;
+    if (latency < wake_latency_min) wake_latency_min = latency;
+    if (latency > wake_latency_max) wake_latency_max = latency;
+}
+
+/* Stage residency counters for diagnostics, little endian. Entries and
+ * exits of the MCU low power modes differ only if a wake up was lost */
+uint8_t lpm_get_stats_report(uint8_t *buf, uint8_t len) {
+    uint8_t i = 0;
+
+    if (len < LPM_STAGE_COUNT * 4 + 8) return 0;
+
+    for (uint8_t stage = 0; stage < LPM_STAGE_COUNT; stage++) {
+        buf[i++] = stage_entries[stage] & 0xFF;
+        buf[i++] = stage_entries[stage] >> 8;
+        buf[i++] = stage_short_stays[stage] & 0xFF;
+        buf[i++] = stage_short_stays[stage] >> 8;
+    }
+    for (uint8_t b = 0; b < 4; b++)
+        buf[i++] = (standby_entries >> (b * 8)) & 0xFF;
+    for (uint8_t b = 0; b < 4; b++)
+        buf[i++] = (standby_exits >> (b * 8)) & 0xFF;
+
+    return i;
+}
+
+void lpm_reset_stats(void) {
+    memset(stage_entries, 0, sizeof(stage_entries));
+    memset(stage_short_stays, 0, sizeof(stage_short_stays));
+    standby_entries = 0;
+    standby_exits   = 0;
+}
+
+/* Wake latency statistics for diagnostics, little endian */
+uint8_t lpm_get_wake_report(uint8_t *buf, uint8_t len) {
+    uint8_t  i   = 0;
+    uint16_t avg = wake_latency_count ? wake_latency_sum / wake_latency_count : 0;
+    uint16_t min = wake_latency_count ? wake_latency_min : 0;
+
+    if (len < 14 + LPM_STAGE_COUNT * 2) return 0;
+
+    buf[i++] = wake_latency_last & 0xFF;
+    buf[i++] = wake_latency_last >> 8;
+    buf[i++] = min & 0xFF;
+    buf[i++] = min >> 8;
+    buf[i++] = wake_latency_max & 0xFF;
+    buf[i++] = wake_latency_max >> 8;
+    buf[i++] = avg & 0xFF;
+    buf[i++] = avg >> 8;
+    buf[i++] = wake_latency_count & 0xFF;
+    buf[i++] = wake_latency_count >> 8;
+    for (uint8_t b = 0; b < 4; b++)
+        buf[i++] = (wake_rows >> (b * 8)) & 0xFF;
+    for (uint8_t stage = 0; stage < LPM_STAGE_COUNT; stage++) {
+        buf[i++] = stage_latency[stage] & 0xFF;
+        buf[i++] = stage_latency[stage] >> 8;
+    }
+
+    return i;
+}
+
 static void lpm_turn_off_backlight_and_led(void) {
     #ifdef RGB_MATRIX_ENABLE
     rgb_matrix_set_color_all(0, 0, 0);
@@ -199,7 +450,13 @@ __attribute__((weak)) void lpm_pre_wakeup(void) {
 __attribute__((weak)) void lpm_wakeup(void) {
     matrix_exit_low_power();
 
+    /* With LPM_FAST_WAKEUP registers and RAM are taken as kept in stop mode
+     * and only the clocks as lost, which lpm_wakeup_init() restores. The
+     * drivers stopped on the way down (USB, SPI, ADC) are started again by
+     * their own code */
+#ifndef LPM_FAST_WAKEUP
     halInit();
+#endif
 
 #ifdef ENCODER_ENABLE
     encoder_cb_init();
@@ -236,10 +493,16 @@ __attribute__((weak)) void lpm_wakeup(void) {
     dip_switch_read(true);
 #endif
 
+#ifndef LPM_FAST_WAKEUP
     /* Call debounce_free() to avoiding memory leak of debounce_counters as debounce_init()
     invoked in matrix_init() alloc new memory to debounce_counters */
     debounce_free();
     matrix_init();
+#else
+    /* Matrix and debounce state are intact, only release the columns driven
+     * for row wake up so that the next scan sees the waking key */
+    unselect_all_cols();
+#endif
 }
 
 __attribute__((weak)) void lpm_post_wakeup(void) {}
@@ -269,47 +532,158 @@ bool allow_low_power_mode(pm_t mode) {
     return true;
 }
 
-void lpm_task(void) {
+static bool lpm_is_quiet(void) {
+    return !indicator_is_running() && lpm_is_kb_idle() &&
+#ifdef LED_MATRIX_ENABLE
+           (!led_matrix_is_enabled() || (led_matrix_is_enabled() && led_matrix_is_driver_shutdown()))
+#elif defined(RGB_MATRIX_ENABLE)
+           (!rgb_matrix_is_enabled() || (rgb_matrix_is_enabled() && rgb_matrix_is_driver_shutdown()))
+#else
+           !bat_level_animiation_actived()
+#endif
+           && !lpm_any_matrix_action();
+}
+
+/* Deepest stage allowed after `idle` ms without activity */
+static uint8_t lpm_next_stage(uint32_t idle) {
+    uint8_t next  = LPM_STAGE_NONE;
+    bool    quiet = lpm_is_quiet();
+    bool    decay = timer_elapsed32(latency_decay_timer) >= LPM_LATENCY_DECAY_MS;
+
+    if (decay) latency_decay_timer = timer_read32();
+
+    for (uint8_t i = 0; i < LPM_STAGE_COUNT; i++) {
+        const lpm_stage_t *stage = &lpm_stages[i];
+
+        if (stage->dwell_ms == 0) continue;
+        if (idle < stage->dwell_ms * (stage_dwell_scale[i] ? stage_dwell_scale[i] : 1)) break;
+        if (stage->quiet && !quiet) continue;
+        // Soft timers do not run while the MCU is stopped
+        if (stage->mode > PM_SLEEP && soft_timer_next_deadline() != SOFT_TIMER_NONE) continue;
+        if (stage_latency[i] > stage->budget_ms) {
+            // Forget slowly so that the stage is tried again some day
+            if (decay) stage_latency[i] -= stage_latency[i] / 8 + 1;
+            continue;
+        }
+        next = i;
+    }
 
-    if (!lpm_time_up && sync_timer_elapsed32(lpm_timer_buffer) > RUN_MODE_PROCESS_TIME) {
-        lpm_time_up      = true;
-        lpm_timer_buffer = 0;
+    return next;
+}
+
+static void lpm_learn_latency(uint8_t stage, uint16_t ms) {
+    stage_latency[stage] = stage_latency[stage] ? (stage_latency[stage] * 3 + ms) / 4 : ms;
+}
+
+static void lpm_enter_stage_low_power(uint8_t stage) {
+    pm_t     mode = lpm_stages[stage].mode;
+    uint64_t start;
+    uint32_t wake;
+
+    lpm_pre_enter_low_power();
+    lpm_enter_low_power();
+    lpm_post_enter_low_power();
+
+    energy_low_power_enter(mode);
+    wake_rows      = 0;
+    wake_key_count = 0;
+    start          = rtc_timer_read64();
+    standby_entries++;
+    lpm_standby(mode);
+    lpm_early_wakeup();
+    lpm_wakeup_init();
+    rtc_timer_resync();
+    wake = timer_read32();
+    if (wake_rows) {
+        wake_pending = true;
+        wake_timer   = wake;
+    }
+    energy_low_power_exit();
+    lpm_pre_wakeup();
+    lpm_wakeup();
+    lpm_post_wakeup();
+    standby_exits++;
+
+    // Drivers and matrix are back only now, the replay wait starts here
+    wake_replay_timer = timer_read32();
+    wake_replay_scans = 0;
+
+    lpm_learn_latency(stage, timer_elapsed32(wake));
+
+    /* Waking up soon after going down costs more than staying up, so back
+     * off this stage while the user is only pausing between bursts */
+    if (rtc_timer_elapsed64(start) < LPM_MIN_RESIDENCY_MS) {
+        stage_short_stays[stage]++;
+        if (stage_dwell_scale[stage] < LPM_MAX_DWELL_SCALE) stage_dwell_scale[stage] = stage_dwell_scale[stage] ? stage_dwell_scale[stage] * 2 : 2;
+    } else if (stage_dwell_scale[stage] > 1) {
+        stage_dwell_scale[stage] /= 2;
+    }
+
+    lpm_timer_reset();
+    report_buffer_init();
+    lpm_set(PM_RUN);
+}
+
+/* Sleep out the rest of the loop period, ending early on a key press. A
+ * PM_SLEEP stage keeps the core in WFI for the whole period, a PM_RUN
+ * stage, or a platform without sleep mode, peeks at the matrix every ms */
+static void lpm_throttle(pm_t mode, uint16_t period) {
+    uint32_t next = soft_timer_next_deadline();
+
+    // Wake up in time for the next soft timer
+    if (next < period) period = next;
+
+    loop_monitor_block_begin(LOOP_SITE_LPM_THROTTLE);
+    energy_idle_begin();
+    if (mode == PM_SLEEP && period > 1 && allow_low_power_mode(PM_SLEEP)) {
+        if (lpm_sleep(period)) lpm_timer_reset();
+        lpm_set(PM_RUN);
+    } else {
+        for (uint16_t t = 1; t < period; t++) {
+            if (lpm_matrix_peek()) {
+                lpm_timer_reset();
+                break;
+            }
+            wait_ms(1);
+        }
     }
+    energy_idle_end();
+    loop_monitor_block_end();
+}
+
+/* Pick the stage to idle in. Only this part is profiled as PROFILE_LPM,
+ * the idling itself is deliberate and would swamp the CPU cost */
+static uint8_t lpm_update_stage(void) {
+    PROFILE_SCOPE(PROFILE_LPM);
 
     if (usb_power_connected() && USBD1.state == USB_STOP) {
         usb_event_queue_init();
         init_usb_driver(&USB_DRIVER);
     }
 
-    if ((get_transport() & TRANSPORT_WIRELESS) && lpm_time_up && !indicator_is_running() && lpm_is_kb_idle()) {
-        if (
-#ifdef LED_MATRIX_ENABLE
-            (!led_matrix_is_enabled() ||
-            (led_matrix_is_enabled() && led_matrix_is_driver_shutdown()))
-#elif defined(RGB_MATRIX_ENABLE)
-            (!rgb_matrix_is_enabled() ||
-            (rgb_matrix_is_enabled() && rgb_matrix_is_driver_shutdown()))
-#else
-            !bat_level_animiation_actived()
-#endif
-            && !lpm_any_matrix_action()) {
+    lpm_wake_replay_task();
 
-            if (allow_low_power_mode(LOW_POWER_MODE)) {
-                lpm_pre_enter_low_power();
-                lpm_enter_low_power();
-                lpm_post_enter_low_power();
+    if (!(get_transport() & TRANSPORT_WIRELESS) || !lpm_timer_running || usb_power_connected()) {
+        lpm_stage = LPM_STAGE_NONE;
+        return lpm_stage;
+    }
 
-                lpm_standby(LOW_POWER_MODE);
-                lpm_early_wakeup();
-                lpm_wakeup_init();
-                lpm_pre_wakeup();
-                lpm_wakeup();
-                lpm_post_wakeup();
+    uint8_t stage = lpm_next_stage(sync_timer_elapsed32(lpm_timer_buffer));
+    if (stage != lpm_stage && stage != LPM_STAGE_NONE) stage_entries[stage]++;
+    lpm_stage = stage;
 
-                lpm_timer_reset();
-                report_buffer_init();
-                lpm_set(PM_RUN);
-            }
-        }
+    return lpm_stage;
+}
+
+void lpm_task(void) {
+    if (lpm_update_stage() == LPM_STAGE_NONE) return;
+
+    if (lpm_stages[lpm_stage].mode <= PM_SLEEP) {
+        // Reports waiting to go out or for an ack need the loop running at full rate
+        if (report_buffer_is_empty() && !report_buffer_inflight()) lpm_throttle(lpm_stages[lpm_stage].mode, lpm_stages[lpm_stage].throttle_ms);
+    } else if (allow_low_power_mode(lpm_stages[lpm_stage].mode)) {
+        loop_monitor_block_begin(LOOP_SITE_LPM_STANDBY);
+        lpm_enter_stage_low_power(lpm_stage);
+        loop_monitor_block_end();
     }
 }
@@ -27,10 +27,88 @@ typedef enum {
     PM_STANDBY,
 } pm_t;
 
+/*
+ * Low power stages, entered one after another while the keyboard stays idle.
+ * PM_RUN stages keep running but only scan every throttle_ms, peeking at the
+ * matrix each millisecond in between so a key press ends them at once.
+ * PM_SLEEP stages also scan every throttle_ms, but keep the core in WFI in
+ * between with the rows armed; clocks, LEDs and the link keep running, so
+ * they are allowed with the backlight on. The deeper stages stop the MCU
+ * until a row, the wireless module or the USB power pin wakes it.
+ *
+ * Deep standby has a dwell of 0 and is off by default. A board enables it
+ * by giving it a dwell in its own LPM_STAGES, once waking from it has been
+ * checked on that board.
+ */
+typedef struct {
+    pm_t     mode;        // PM_RUN and PM_SLEEP stages only slow down the main loop
+    bool     quiet;       // Only entered with the LEDs off and no key held
+    uint16_t throttle_ms; // Main loop period while in the stage
+    uint32_t dwell_ms;    // Idle time before the stage is entered, 0 disables it
+    uint16_t budget_ms;   // Longest acceptable wake latency
+} lpm_stage_t;
+
+#ifndef LPM_STAGES
+// clang-format off
+#    define LPM_STAGES {                                                        \
+        /* Reduced scan rate */  {PM_RUN,         false, 2,  100,                   2   }, \
+        /* LED frame drop */     {PM_RUN,         false, 33, 500,                   2   }, \
+        /* Core sleep */         {PM_SLEEP,       false, 50, 700,                   2   }, \
+        /* STOP, row wake */     {LOW_POWER_MODE, true,  0,  RUN_MODE_PROCESS_TIME, 100 }, \
+        /* Deep standby */       {PM_STANDBY,     true,  0,  0,                     1000}, \
+    }
+// clang-format on
+#endif
+
+/* A deep stage left sooner than this is entered later the next time */
+#ifndef LPM_MIN_RESIDENCY_MS
+#    define LPM_MIN_RESIDENCY_MS 3000
+#endif
+
+#ifndef LPM_MAX_DWELL_SCALE
+#    define LPM_MAX_DWELL_SCALE 8
+#endif
+
+/* A stage whose learned wake latency is over budget is skipped, and the
+ * latency is forgotten by an eighth every this many ms so it is retried */
+#ifndef LPM_LATENCY_DECAY_MS
+#    define LPM_LATENCY_DECAY_MS 60000
+#endif
+
+#define LPM_STAGE_NONE 0xFF
+
+/* A key that woke the MCU and is not seen by the matrix within this many
+ * ms past the debounce time, counted from the end of wake up, and in at
+ * least LPM_WAKE_REPLAY_SCANS scans is replayed as a tap */
+#ifndef LPM_WAKE_REPLAY_MS
+#    define LPM_WAKE_REPLAY_MS 20
+#endif
+
+#ifndef LPM_WAKE_REPLAY_SCANS
+#    define LPM_WAKE_REPLAY_SCANS 4
+#endif
+
+#ifndef LPM_WAKE_KEY_MAX
+#    define LPM_WAKE_KEY_MAX 4 // At most 8
+#endif
+
+/* Wake up runs halInit() and matrix_init() again. Define LPM_FAST_WAKEUP
+ * to resume the drivers in place instead, which relies on every peripheral
+ * keeping its registers in stop mode. Only opt in on an MCU where that has
+ * been checked on hardware */
+// #define LPM_FAST_WAKEUP
+
+/* NOP cycles a probed column settles before the rows are read on wake up */
+#ifndef LPM_SETTLE_NOPS
+#    define LPM_SETTLE_NOPS 100
+#endif
+
 void lpm_init(void);
 void lpm_timer_reset(void);
 void lpm_timer_stop(void);
 void select_all_cols(void);
+void unselect_all_cols(void);
+uint32_t lpm_probe_col(uint8_t col);
 void matrix_enter_low_power(void);
 void matrix_exit_low_power(void);
 void lpm_pre_enter_low_power(void);
@@ -46,4 +124,13 @@ void lpm_post_wakeup(void);
 bool usb_power_connected(void);
 bool lpm_is_kb_idle(void);
 bool lpm_set(pm_t mode);
+bool lpm_matrix_peek(void);
+bool lpm_sleep(uint16_t period);
+uint8_t lpm_get_stage(void);
+void lpm_capture_wake_rows(void);
+uint32_t lpm_get_wake_rows(void);
+void lpm_report_sent(void);
+uint8_t lpm_get_wake_report(uint8_t *buf, uint8_t len);
+uint8_t lpm_get_stats_report(uint8_t *buf, uint8_t len);
+void lpm_reset_stats(void);
 void lpm_task(void);
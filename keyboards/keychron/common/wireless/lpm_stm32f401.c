@@ -127,6 +127,7 @@ void lpm_standby(pm_t mode) {
 #endif
 
     __WFI();
+    lpm_capture_wake_rows();
 
     SCB->SCR &= ~SCB_SCR_SLEEPDEEP_Msk;
 }
@@ -17,6 +17,12 @@
 #include "quantum.h"
 #include "lpm.h"
 
+/* __early_init() runs again on wake up from STOP LP4, nothing shows the
+ * peripherals keep their setup through it */
+#ifdef LPM_FAST_WAKEUP
+#    error "LPM_FAST_WAKEUP has not been verified on the WB32F3G71"
+#endif
+
 bool wakeup_from_lpm;
 
 // clang-format off
@@ -104,6 +110,7 @@ void lpm_standby(pm_t mode) {
 
     rtclp_lld_init();
     stop_mode_entry();
+    lpm_capture_wake_rows();
     chSysEnable();
 }
 
@@ -18,12 +18,15 @@
 #include "report_buffer.h"
 #include "wireless.h"
 #include "lpm.h"
+#include "link_stats.h"
+#include "profiler.h"
 
 /* The report buffer is mainly used to fix key press lost issue of macro
- * when wireless module fifo isn't large enough. The maximun macro
- * string length is determined by this queue size, and should be
- * REPORT_BUFFER_QUEUE_SIZE devided by 2 since each character is implemented
- * by sending a key pressing then a key releasing report.
+ * when wireless module fifo isn't large enough. A macro sending a string at
+ * once is limited to REPORT_BUFFER_QUEUE_SIZE devided by 2 characters since
+ * each character is implemented by sending a key pressing then a key
+ * releasing report. Longer macros should check report_buffer_free() and
+ * yield until there is room again.
  * Please note that it cosume sizeof(report_buffer_t)  * REPORT_BUFFER_QUEUE_SIZE
  * bytes RAM, with default setting, used RAM size is
  *        sizeof(report_buffer_t) * 256 = 34* 256  =  8704 bytes
@@ -43,12 +46,43 @@ extern wt_func_t wireless_transport;
 uint8_t report_interval = DEFAULT_2P4G_REPORT_INVERVAL_MS;
 
 static uint32_t report_timer_buffer = 0;
-uint32_t        retry_time_buffer   = 0;
 report_buffer_t report_buffer_queue[REPORT_BUFFER_QUEUE_SIZE];
 uint16_t        report_buffer_queue_head;
 uint16_t        report_buffer_queue_tail;
-report_buffer_t kb_rpt;
-uint8_t         retry = 0;
+
+/* Reports handed to the module and not acked yet, oldest first. A lost
+ * report is resent together with the unacked reports sent after it, in
+ * order. At most one report of each class that is acked is in flight, a
+ * later report of the class waits in the queue until the earlier one is
+ * acked or given up on. That way no report is ever skipped, and an ack,
+ * which only names the command it belongs to, matches exactly one entry */
+typedef struct {
+    report_buffer_t report;
+    uint32_t        first_sent;
+    uint32_t        sent_time;
+    uint8_t         frames; // Frames of the last transmission not acked yet
+    uint8_t         retry;
+    bool            ack_wanted;
+    bool            acked;
+} report_inflight_t;
+
+static report_inflight_t inflight[REPORT_BUFFER_INFLIGHT_MAX];
+static uint8_t           inflight_count = 0;
+static uint8_t           inflight_sent  = 0; // Entries before this index are on the air
+
+/* Times a report of each class is resent until the module acks it. Mouse
+ * reports carry relative movement and are sent without ack, resending one
+ * would move the pointer twice */
+// clang-format off
+static const uint8_t report_retry_count[REPORT_TYPE_MAX] = {
+    [REPORT_TYPE_NONE]     = 0,
+    [REPORT_TYPE_KB]       = RETPORT_RETRY_COUNT,
+    [REPORT_TYPE_NKRO]     = RETPORT_RETRY_COUNT,
+    [REPORT_TYPE_CONSUMER] = RETPORT_RETRY_COUNT,
+    [REPORT_TYPE_SYSTEM]   = RETPORT_RETRY_COUNT,
+    [REPORT_TYPE_MOUSE]    = 0,
+};
+// clang-format on
 
 void report_buffer_task(void);
 
@@ -57,18 +91,49 @@ void report_buffer_init(void) {
     memset(&report_buffer_queue, 0, sizeof(report_buffer_queue));
     report_buffer_queue_head = 0;
     report_buffer_queue_tail = 0;
-    retry                    = 0;
+    inflight_count           = 0;
+    inflight_sent            = 0;
     report_timer_buffer      = timer_read32();
 }
 
+/* Mouse movement queued behind other reports is summed into the last queued
+ * mouse report as long as the buttons are unchanged and the sums fit, so a
+ * busy link delays the pointer instead of piling up reports */
+static bool report_buffer_merge_mouse(report_mouse_t *report) {
+    if (report_buffer_is_empty()) return false;
+
+    report_buffer_t *tail = &report_buffer_queue[(report_buffer_queue_head + REPORT_BUFFER_QUEUE_SIZE - 1) % REPORT_BUFFER_QUEUE_SIZE];
+    report_mouse_t  *last = &tail->mouse;
+
+    if (tail->type != REPORT_TYPE_MOUSE || last->buttons != report->buttons) return false;
+
+    int32_t x = last->x + report->x;
+    int32_t y = last->y + report->y;
+    int16_t v = last->v + report->v;
+    int16_t h = last->h + report->h;
+
+    if (x < MOUSE_REPORT_XY_MIN || x > MOUSE_REPORT_XY_MAX || y < MOUSE_REPORT_XY_MIN || y > MOUSE_REPORT_XY_MAX) return false;
+    if (v < INT8_MIN || v > INT8_MAX || h < INT8_MIN || h > INT8_MAX) return false;
+
+    last->x = x;
+    last->y = y;
+    last->v = v;
+    last->h = h;
+    return true;
+}
+
 bool report_buffer_enqueue(report_buffer_t *report) {
+    if (report->type == REPORT_TYPE_MOUSE && report_buffer_merge_mouse(&report->mouse)) return true;
+
     uint16_t next = (report_buffer_queue_head + 1) % REPORT_BUFFER_QUEUE_SIZE;
     if (next == report_buffer_queue_tail) {
+        link_stats_enqueue_failed();
         return false;
     }
 
     report_buffer_queue[report_buffer_queue_head] = *report;
     report_buffer_queue_head                      = next;
+    link_stats_queue_depth(REPORT_BUFFER_QUEUE_SIZE - 1 - report_buffer_free());
     return true;
 }
 
@@ -86,6 +151,13 @@ bool report_buffer_is_empty() {
     return report_buffer_queue_head == report_buffer_queue_tail;
 }
 
+uint16_t report_buffer_free(void) {
+    uint16_t used = (report_buffer_queue_head + REPORT_BUFFER_QUEUE_SIZE - report_buffer_queue_tail) % REPORT_BUFFER_QUEUE_SIZE;
+
+    // One slot is always kept empty to tell a full queue from an empty one
+    return REPORT_BUFFER_QUEUE_SIZE - 1 - used;
+}
+
 void report_buffer_update_timer(void) {
     report_timer_buffer = timer_read32();
 }
@@ -99,46 +171,155 @@ void report_buffer_set_inverval(uint8_t interval) {
     report_interval = interval;
 }
 
-uint8_t report_buffer_get_retry(void) {
-    return retry;
+uint8_t report_buffer_inflight(void) {
+    return inflight_count;
+}
+
+/* Hand a report of any class to the wireless transport */
+bool report_buffer_send(report_buffer_t *report) {
+    switch (report->type) {
+        case REPORT_TYPE_KB:
+            if (!wireless_transport.send_keyboard) return false;
+            wireless_transport.send_keyboard(&report->keyboard.mods);
+            break;
+#if defined(NKRO_ENABLE) && defined(WIRELESS_NKRO_ENABLE)
+        case REPORT_TYPE_NKRO:
+            if (!wireless_transport.send_nkro) return false;
+            wireless_transport.send_nkro(&report->nkro.mods);
+            break;
+#endif
+        case REPORT_TYPE_CONSUMER:
+            if (!wireless_transport.send_consumer) return false;
+            wireless_transport.send_consumer(report->consumer);
+            break;
+        case REPORT_TYPE_SYSTEM:
+            if (!wireless_transport.send_system) return false;
+            wireless_transport.send_system(report->system);
+            break;
+        case REPORT_TYPE_MOUSE:
+            if (!wireless_transport.send_mouse) return false;
+            wireless_transport.send_mouse((uint8_t *)&report->mouse);
+            break;
+        default:
+            return false;
+    }
+
+    return true;
+}
+
+static void report_buffer_transmit(report_inflight_t *entry) {
+    uint8_t sn   = wireless_transport.last_sn ? wireless_transport.last_sn() : 0;
+    bool    sent = report_buffer_send(&entry->report);
+    uint8_t last = wireless_transport.last_sn ? wireless_transport.last_sn() : 0;
+
+    entry->frames = last - sn;
+    if (last < sn) entry->frames--; // 0 is never used as sequence number
+    entry->sent_time = timer_read32();
+    // Classes sent without ack and reports the transport dropped are done once handed over
+    entry->ack_wanted = sent && report_retry_count[entry->report.type] && entry->frames;
+    entry->acked      = !entry->ack_wanted;
 }
 
-void report_buffer_set_retry(uint8_t times) {
-    retry = times;
+static uint8_t report_class(uint8_t type) {
+    return type == REPORT_TYPE_NKRO ? REPORT_TYPE_KB : type;
+}
+
+/* Index of the unacked entry of the class of type, or inflight_count */
+static uint8_t report_buffer_find_unacked(uint8_t type) {
+    uint8_t i;
+
+    for (i = 0; i < inflight_count; i++) {
+        if (!inflight[i].acked && report_class(inflight[i].report.type) == report_class(type)) break;
+    }
+
+    return i;
+}
+
+/* Send the unacked entries from index on again */
+static void report_buffer_go_back(uint8_t index) {
+    if (index < inflight_sent) inflight_sent = index;
+}
+
+/* Called by the transport for every ack of a report frame of the given
+ * type. A NACK, either a checksum error or a full module FIFO, resends from
+ * that report on */
+void report_buffer_ack(uint8_t type, bool success) {
+    uint8_t i = report_buffer_find_unacked(type);
+
+    if (i >= inflight_count || !inflight[i].ack_wanted) return;
+
+    if (!success) {
+        report_buffer_go_back(i);
+    } else if (inflight[i].frames && --inflight[i].frames == 0) {
+        inflight[i].acked = true;
+        link_stats_latency(timer_elapsed32(inflight[i].first_sent));
+    }
 }
 
 void report_buffer_task(void) {
-    if (wireless_get_state() == WT_CONNECTED && (!report_buffer_is_empty() || retry) && report_buffer_next_inverval()) {
-        bool pending_data = false;
-
-        if (!retry) {
-            if (report_buffer_dequeue(&kb_rpt) && kb_rpt.type != REPORT_TYPE_NONE) {
-                if (timer_read32() > 2) {
-                    pending_data      = true;
-                    retry             = RETPORT_RETRY_COUNT;
-                    retry_time_buffer = timer_read32();
-                }
-            }
+    PROFILE_SCOPE(PROFILE_REPORT_BUFFER);
+
+    if (wireless_get_state() != WT_CONNECTED) return;
+
+    // Oldest frame still unacked after the timeout is taken as lost
+    for (uint8_t i = 0; i < inflight_sent; i++) {
+        if (inflight[i].acked) continue;
+        if (timer_elapsed32(inflight[i].sent_time) > REPORT_BUFFER_ACK_TIMEOUT_MS) {
+            link_stats_ack(LINK_ACK_TIMEOUT);
+            report_buffer_go_back(i);
+        }
+        break;
+    }
+
+    while (inflight_count && inflight[0].acked) {
+        memmove(&inflight[0], &inflight[1], (inflight_count - 1) * sizeof(report_inflight_t));
+        inflight_count--;
+        if (inflight_sent) inflight_sent--;
+    }
+
+    if (!report_buffer_next_inverval()) return;
+
+    report_inflight_t *entry = NULL;
+
+    while (inflight_sent < inflight_count) {
+        entry = &inflight[inflight_sent++];
+        if (entry->acked) {
+            entry = NULL;
+        } else if (entry->retry == 0) {
+            entry->acked = true; // Give up on it, later reports still go out
+            entry = NULL;
         } else {
-            if (timer_elapsed32(retry_time_buffer) > 2) {
-                pending_data = true;
-                --retry;
-                retry_time_buffer = timer_read32();
-            }
+            entry->retry--;
+            link_stats_retry();
+            break;
         }
+    }
 
-        if (pending_data) {
-#if defined(NKRO_ENABLE) && defined(WIRELESS_NKRO_ENABLE)
-            if (kb_rpt.type == REPORT_TYPE_NKRO && wireless_transport.send_nkro) {
-                wireless_transport.send_nkro(&kb_rpt.nkro.mods);
-            } else if (kb_rpt.type == REPORT_TYPE_KB && wireless_transport.send_keyboard)
-                wireless_transport.send_keyboard(&kb_rpt.keyboard.mods);
-#else
-            if (kb_rpt.type == REPORT_TYPE_KB && wireless_transport.send_keyboard) wireless_transport.send_keyboard(&kb_rpt.keyboard.mods);
-#endif
-            if (kb_rpt.type == REPORT_TYPE_CONSUMER && wireless_transport.send_consumer) wireless_transport.send_consumer(kb_rpt.consumer);
-            report_timer_buffer = timer_read32();
-            lpm_timer_reset();
+    if (!entry && inflight_count < REPORT_BUFFER_INFLIGHT_MAX) {
+        report_buffer_t report;
+
+        while (!report_buffer_is_empty()) {
+            uint8_t type = report_buffer_queue[report_buffer_queue_tail].type;
+
+            // Waits for the ack of the report of its class still in flight
+            if (type > REPORT_TYPE_NONE && type < REPORT_TYPE_MAX && report_retry_count[type] && report_buffer_find_unacked(type) < inflight_count) break;
+
+            report_buffer_dequeue(&report);
+            if (report.type == REPORT_TYPE_NONE || report.type >= REPORT_TYPE_MAX) continue;
+
+            entry             = &inflight[inflight_count++];
+            entry->report     = report;
+            entry->retry      = report_retry_count[report.type];
+            entry->first_sent = timer_read32();
+            inflight_sent++;
+            break;
         }
     }
+
+    if (entry) {
+        report_buffer_transmit(entry);
+        report_timer_buffer = timer_read32();
+        lpm_timer_reset();
+        lpm_report_sent();
+    }
 }
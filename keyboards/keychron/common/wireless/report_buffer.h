@@ -33,11 +33,24 @@
 #    define RETPORT_RETRY_COUNT 30
 #endif
 
+/* Report frames sent to the module before an ack has to come back */
+#ifndef REPORT_BUFFER_INFLIGHT_MAX
+#    define REPORT_BUFFER_INFLIGHT_MAX 4
+#endif
+
+/* A frame not acked within this time is resent */
+#ifndef REPORT_BUFFER_ACK_TIMEOUT_MS
+#    define REPORT_BUFFER_ACK_TIMEOUT_MS 10
+#endif
+
 enum {
     REPORT_TYPE_NONE,
     REPORT_TYPE_KB,
     REPORT_TYPE_NKRO,
     REPORT_TYPE_CONSUMER,
+    REPORT_TYPE_SYSTEM,
+    REPORT_TYPE_MOUSE,
+    REPORT_TYPE_MAX,
 };
 
 typedef struct {
@@ -46,16 +59,20 @@ typedef struct {
         report_keyboard_t keyboard;
         report_nkro_t     nkro;
         uint16_t          consumer;
+        uint16_t          system;
+        report_mouse_t    mouse;
     };
 } report_buffer_t;
 
-void    report_buffer_init(void);
-bool    report_buffer_enqueue(report_buffer_t *report);
-bool    report_buffer_dequeue(report_buffer_t *report);
-bool    report_buffer_is_empty(void);
-void    report_buffer_update_timer(void);
-bool    report_buffer_next_inverval(void);
-void    report_buffer_set_inverval(uint8_t interval);
-uint8_t report_buffer_get_retry(void);
-void    report_buffer_set_retry(uint8_t times);
-void    report_buffer_task(void);
+void     report_buffer_init(void);
+bool     report_buffer_enqueue(report_buffer_t *report);
+bool     report_buffer_dequeue(report_buffer_t *report);
+bool     report_buffer_is_empty(void);
+uint16_t report_buffer_free(void);
+void     report_buffer_update_timer(void);
+bool     report_buffer_next_inverval(void);
+void     report_buffer_set_inverval(uint8_t interval);
+uint8_t  report_buffer_inflight(void);
+void     report_buffer_ack(uint8_t type, bool success);
+bool     report_buffer_send(report_buffer_t *report);
+void     report_buffer_task(void);
@@ -20,12 +20,49 @@
 
 #    include "rtc_timer.h"
 
+/*
+ * Monotonic time is kept as a 64-bit base plus the system timer delta since
+ * the base was last synced, so reading it costs no RTC access. The system
+ * timer stops in STOP mode, so the base is advanced from the RTC date and
+ * time on wake up, and at least every RTC_RESYNC_INTERVAL so that the
+ * system timer cannot wrap between two syncs.
+ */
+static uint64_t mono_base   = 0;
+static uint32_t sys_at_sync = 0;
+static uint64_t rtc_at_sync = 0;
+
+/* Days since 1980-01-01 of the RTC date, good until 2100 */
+static uint32_t rtc_timer_days(const RTCDateTime *tm) {
+    static const uint16_t days_before_month[12] = {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334};
+    uint32_t              days                  = (uint32_t)tm->year * 365 + (tm->year + 3) / 4;
+
+    if (tm->month >= 1 && tm->month <= 12) days += days_before_month[tm->month - 1];
+    if (tm->month > 2 && tm->year % 4 == 0) days++;
+    if (tm->day) days += tm->day - 1;
+
+    return days;
+}
+
+/* Milliseconds since the RTC was cleared, with the date folded in so that
+ * a stop mode stay of a day or more is not lost */
+static uint64_t rtc_timer_read_ms64(void) {
+    RTCDateTime tm;
+    rtcGetTime(&RTCD1, &tm);
+
+    return (uint64_t)rtc_timer_days(&tm) * RTC_MAX_TIME + tm.millisecond;
+}
+
 void rtc_timer_init(void) {
     rtc_timer_clear();
+    mono_base   = 0;
+    sys_at_sync = timer_read32();
+    rtc_at_sync = rtc_timer_read_ms64();
 }
 
+/* Start from a valid date, 1980-01-01, so the RTC carries midnight into the
+ * date registers */
 void rtc_timer_clear(void) {
-    RTCDateTime tm = {0, 0, 0, 0, 0, 0};
+    RTCDateTime tm = {.year = 0, .month = 1, .dstflag = 0, .dayofweek = 1, .day = 1, .millisecond = 0};
     rtcSetTime(&RTCD1, &tm);
 }
 
@@ -36,8 +73,40 @@ uint32_t rtc_timer_read_ms(void) {
     return tm.millisecond;
 }
 
+/* The RTC counts milliseconds since midnight, so it wraps after RTC_MAX_TIME */
 uint32_t rtc_timer_elapsed_ms(uint32_t last) {
-    return TIMER_DIFF_32(rtc_timer_read_ms(), last);
+    uint32_t now = rtc_timer_read_ms();
+
+    return now >= last ? now - last : now + RTC_MAX_TIME - last;
+}
+
+void rtc_timer_resync(void) {
+    uint32_t sys_now = timer_read32();
+    uint64_t rtc_now = rtc_timer_read_ms64();
+    uint64_t sys     = mono_base + TIMER_DIFF_32(sys_now, sys_at_sync);
+    uint64_t rtc     = mono_base + (rtc_now >= rtc_at_sync ? rtc_now - rtc_at_sync : 0);
+
+    // The two clocks drift apart a little, never let time go backwards
+    mono_base   = rtc > sys ? rtc : sys;
+    sys_at_sync = sys_now;
+    rtc_at_sync = rtc_now;
+}
+
+uint64_t rtc_timer_read64(void) {
+    uint32_t delta = TIMER_DIFF_32(timer_read32(), sys_at_sync);
+
+    if (delta >= RTC_RESYNC_INTERVAL) {
+        rtc_timer_resync();
+        return mono_base;
+    }
+
+    return mono_base + delta;
+}
+
+uint32_t rtc_timer_elapsed64(uint64_t last) {
+    uint64_t elapsed = rtc_timer_read64() - last;
+
+    return elapsed > UINT32_MAX ? UINT32_MAX : elapsed;
 }
 
 #endif
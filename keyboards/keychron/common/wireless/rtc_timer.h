@@ -21,6 +21,10 @@
 
 #define RTC_MAX_TIME (24 * 3600 * 1000) // Set to 1 day
 
+#ifndef RTC_RESYNC_INTERVAL
+#    define RTC_RESYNC_INTERVAL (3600 * 1000)
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -30,6 +34,11 @@ void     rtc_timer_clear(void);
 uint32_t rtc_timer_read_ms(void);
 uint32_t rtc_timer_elapsed_ms(uint32_t last);
 
+/* Monotonic milliseconds since boot, valid across STOP mode */
+void     rtc_timer_resync(void);
+uint64_t rtc_timer_read64(void);
+uint32_t rtc_timer_elapsed64(uint64_t last);
+
 #ifdef __cplusplus
 }
 #endif
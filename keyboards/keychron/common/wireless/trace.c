@@ -0,0 +1,93 @@
+/* Copyright 2025 @ Keychron (https://www.keychron.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/******************************************************************************
+ *
+ *  Filename:      trace.c
+ *
+ *  Description:   Ring of fixed size event records, cheap enough to be kept
+ *                 in release builds and drained over raw HID
+ *
+ ******************************************************************************/
+
+#include "quantum.h"
+#include "trace.h"
+
+_Static_assert((TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)) == 0, "TRACE_RING_SIZE must be a power of two");
+
+static trace_record_t trace_ring[TRACE_RING_SIZE];
+static uint32_t       trace_head = 0; // Records ever written
+static uint32_t       trace_tail = 0; // Records ever drained or overwritten
+static uint32_t       trace_lost = 0;
+
+/* A slot is claimed with a single atomic add so an interrupt may write a
+ * record in the middle of another one without a lock. The id is written
+ * last, a slot still reading TRACE_NONE is claimed but not filled yet */
+void trace_event(uint8_t id, uint8_t arg0, uint16_t arg1) {
+    uint32_t        index  = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED);
+    trace_record_t *record = &trace_ring[index & (TRACE_RING_SIZE - 1)];
+
+    __atomic_store_n(&record->id, TRACE_NONE, __ATOMIC_RELAXED);
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    record->time = timer_read32();
+    record->arg0 = arg0;
+    record->arg1 = arg1;
+    __atomic_store_n(&record->id, id, __ATOMIC_RELEASE);
+}
+
+void trace_clear(void) {
+    trace_tail = __atomic_load_n(&trace_head, __ATOMIC_ACQUIRE);
+    trace_lost = 0;
+}
+
+/* Move the oldest records into buf, little endian:
+ *   count (u8), lost since the last drain (u16), records still pending (u8),
+ *   then count records of sizeof(trace_record_t) bytes.
+ * Slots claimed but not filled yet are skipped. Returns the length used.
+ * host/trace_decode.py turns the replies into a timeline */
+uint8_t trace_drain(uint8_t *buf, uint8_t len) {
+    uint32_t head  = __atomic_load_n(&trace_head, __ATOMIC_ACQUIRE);
+    uint8_t  i     = 4;
+    uint8_t  count = 0;
+
+    if (len < i) return 0;
+
+    if (head - trace_tail > TRACE_RING_SIZE) {
+        trace_lost += head - trace_tail - TRACE_RING_SIZE;
+        trace_tail = head - TRACE_RING_SIZE;
+    }
+
+    while (trace_tail != head && i + sizeof(trace_record_t) <= len) {
+        trace_record_t *record = &trace_ring[trace_tail++ & (TRACE_RING_SIZE - 1)];
+
+        if (__atomic_load_n(&record->id, __ATOMIC_ACQUIRE) == TRACE_NONE) continue;
+
+        memcpy(&buf[i], record, sizeof(trace_record_t));
+        i += sizeof(trace_record_t);
+        count++;
+    }
+
+    uint32_t pending = head - trace_tail;
+    uint16_t lost    = trace_lost > UINT16_MAX ? UINT16_MAX : trace_lost;
+
+    buf[0]     = count;
+    buf[1]     = lost & 0xFF;
+    buf[2]     = lost >> 8;
+    buf[3]     = pending > UINT8_MAX ? UINT8_MAX : pending;
+    trace_lost = 0;
+
+    return i;
+}
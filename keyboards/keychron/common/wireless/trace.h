@@ -0,0 +1,54 @@
+/* Copyright 2025 @ Keychron (https://www.keychron.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* Records kept, a power of two. The oldest records are overwritten */
+#ifndef TRACE_RING_SIZE
+#    define TRACE_RING_SIZE 64
+#endif
+
+enum {
+    TRACE_NONE,
+    TRACE_TRANSPORT_CHANGED,     // arg0: new transport
+    TRACE_WIRELESS_PAIRING,      // arg0: host index
+    TRACE_WIRELESS_CONNECT,      // arg0: host index
+    TRACE_WIRELESS_DISCONNECT,   //
+    TRACE_WIRELESS_RESET,        //
+    TRACE_WIRELESS_DISCOVERABLE, // arg0: host index
+    TRACE_WIRELESS_RECONNECTING, // arg0: host index
+    TRACE_WIRELESS_CONNECTED,    // arg0: host index
+    TRACE_WIRELESS_DISCONNECTED, // arg0: host index, arg1: reason
+    TRACE_WIRELESS_SLEEP,        // arg0: wireless state
+    TRACE_WIRELESS_SUSPEND,      //
+    TRACE_LKBT51_EVENT,          // arg0: event type, arg1: first data byte
+    TRACE_LKBT51_PROTOCOL_VER,   // arg1: module protocol version
+    TRACE_FACTORY_INT_PIN,       // arg0: INT pin level
+};
+
+/* One record as sent over raw HID, little endian */
+typedef struct {
+    uint32_t time; // timer_read32() when written
+    uint8_t  id;
+    uint8_t  arg0;
+    uint16_t arg1;
+} trace_record_t;
+
+void    trace_event(uint8_t id, uint8_t arg0, uint16_t arg1);
+void    trace_clear(void);
+uint8_t trace_drain(uint8_t *buf, uint8_t len);
@@ -24,6 +24,8 @@
 #endif
 #include "transport.h"
 #include "lkbt51.h"
+#include "trace.h"
+#include "loop_monitor.h"
 
 #ifndef REINIT_LED_DRIVER
 #    define REINIT_LED_DRIVER 0
@@ -55,9 +57,11 @@ __attribute__((weak)) void bt_transport_enable(bool enable) {
         wireless_disconnect();
 
         uint32_t t = timer_read32();
+        loop_monitor_block_begin(LOOP_SITE_TRANSPORT_ENABLE);
         while (timer_elapsed32(t) < 100) {
             wireless_transport.task();
         }
+        loop_monitor_block_end();
         // wireless_connect();
         wireless_connect_ex(30, 0);
         // TODO: Clear USB report
@@ -83,9 +87,11 @@ __attribute__((weak)) void p24g_transport_enable(bool enable) {
         wireless_disconnect();
 
         uint32_t t = timer_read32();
+        loop_monitor_block_begin(LOOP_SITE_TRANSPORT_ENABLE);
         while (timer_elapsed32(t) < 100) {
             wireless_transport.task();
         }
+        loop_monitor_block_end();
         wireless_connect_ex(P24G_INDEX, 0);
         // wireless_connect();
         //  TODO: Clear USB report
@@ -177,8 +183,10 @@ transport_t get_transport(void) {
 static void reinit_led_drvier(void) {
     /* Wait circuit to discharge for a while */
     systime_t start = chVTGetSystemTime();
+    loop_monitor_block_begin(LOOP_SITE_TRANSPORT_ENABLE);
     while (chTimeI2MS(chVTTimeElapsedSinceX(start)) < 100) {
     };
+    loop_monitor_block_end();
 
 #    ifdef LED_MATRIX_ENABLE
     led_matrix_init();
@@ -190,7 +198,7 @@ static void reinit_led_drvier(void) {
 #endif
 
 void transport_changed(transport_t new_transport) {
-    kc_printf("transport_changed %d\n\r", new_transport);
+    trace_event(TRACE_TRANSPORT_CHANGED, new_transport, 0);
     indicator_init();
 
 #if (REINIT_LED_DRIVER)
@@ -213,9 +221,12 @@ void transport_changed(transport_t new_transport) {
 
 void usb_remote_wakeup(void) {
     if (USB_DRIVER.state == USB_SUSPENDED) {
+        // The host suspend can last hours, only the remote wake up is a stall
+        loop_monitor_block_begin(LOOP_SITE_USB_SUSPEND);
         while (USB_DRIVER.state == USB_SUSPENDED) {
             wireless_pre_task();
             if (get_transport() != TRANSPORT_USB) {
+                loop_monitor_block_end();
                 suspend_wakeup_init_quantum();
                 return;
             }
@@ -227,6 +238,8 @@ void usb_remote_wakeup(void) {
                 //|| encoder_read()
 #endif
                 ) {
+                loop_monitor_block_end();
+                loop_monitor_block_begin(LOOP_SITE_USB_REMOTE_WAKEUP);
                 usbWakeupHost(&USB_DRIVER);
                 wait_ms(300);
 #ifdef MOUSEKEY_ENABLE
@@ -246,8 +259,11 @@ void usb_remote_wakeup(void) {
                 del_mods(0x02);
                 send_keyboard_report();
 #endif
+                loop_monitor_block_end();
+                loop_monitor_block_begin(LOOP_SITE_USB_SUSPEND);
             }
         }
+        loop_monitor_block_end();
         /* Woken up */
         // variables has been already cleared by the wakeup hook
         send_keyboard_report();
@@ -22,14 +22,15 @@
 #include "indicator.h"
 #include "transport.h"
 #include "rtc_timer.h"
+#include "energy.h"
+#include "link_stats.h"
+#include "trace.h"
+#include "loop_monitor.h"
 #include "keychron_wireless_common.h"
 #include "keychron_task.h"
 
-extern uint8_t         pairing_indication;
-extern host_driver_t   chibios_driver;
-extern report_buffer_t kb_rpt;
-extern uint32_t        retry_time_buffer;
-extern uint8_t         retry;
+extern uint8_t       pairing_indication;
+extern host_driver_t chibios_driver;
 
 static uint8_t host_index = 0;
 static uint8_t led_state  = 0;
@@ -98,6 +99,7 @@ void wireless_init(void) {
 #endif
 
     battery_init();
+    energy_init();
     lpm_init();
 #if HAL_USE_RTC
     rtc_timer_init();
@@ -126,7 +128,7 @@ void wireless_pairing(void) {
  * Enter pairing with specified host index and param
  */
 void wireless_pairing_ex(uint8_t host_idx, void *param) {
-    kc_printf("wireless_pairing_ex %d\n\r", host_idx);
+    trace_event(TRACE_WIRELESS_PAIRING, host_idx, 0);
     if (battery_is_critical_low()) return;
 
     if (wireless_transport.pairing_ex) wireless_transport.pairing_ex(host_idx, param);
@@ -153,7 +155,7 @@ void wireless_connect(void) {
  * Initiate connection request to paired host with argument
  */
 void wireless_connect_ex(uint8_t host_idx, uint16_t timeout) {
-    kc_printf("wireless_connect_ex %d\n\r", host_idx);
+    trace_event(TRACE_WIRELESS_CONNECT, host_idx, 0);
     if (battery_is_critical_low()) return;
 
     if (host_idx != 0) {
@@ -169,13 +171,13 @@ void wireless_connect_ex(uint8_t host_idx, uint16_t timeout) {
 
 /* Initiate a disconnection */
 void wireless_disconnect(void) {
-    kc_printf("wireless_disconnect\n\r");
+    trace_event(TRACE_WIRELESS_DISCONNECT, 0, 0);
     if (wireless_transport.disconnect) wireless_transport.disconnect();
 }
 
 /* Called when the BT device is reset. */
 static void wireless_enter_reset(uint8_t reason) {
-    kc_printf("wireless_enter_reset\n\r");
+    trace_event(TRACE_WIRELESS_RESET, 0, 0);
     wireless_state = WT_RESET;
     wireless_enter_reset_kb(reason);
 }
@@ -185,7 +187,7 @@ static void wireless_enter_reset(uint8_t reason) {
  *   - set pairing indication
  */
 static void wireless_enter_discoverable(uint8_t host_idx) {
-    kc_printf("wireless_enter_discoverable: %d\n\r", host_idx);
+    trace_event(TRACE_WIRELESS_DISCOVERABLE, host_idx, 0);
     host_index = host_idx;
 
     wireless_state = WT_PARING;
@@ -201,7 +203,8 @@ static void wireless_enter_discoverable(uint8_t host_idx) {
 static void wireless_enter_reconnecting(uint8_t host_idx) {
     host_index = host_idx;
 
-    kc_printf("wireless_reconnecting %d\n\r", host_idx);
+    trace_event(TRACE_WIRELESS_RECONNECTING, host_idx, 0);
+    link_stats_reconnecting();
     wireless_state = WT_RECONNECTING;
     indicator_set(wireless_state, host_idx);
     wireless_enter_reconnecting_kb(host_idx);
@@ -213,7 +216,8 @@ static void wireless_enter_reconnecting(uint8_t host_idx) {
  *   - enable NKRO if it is support
  */
 static void wireless_enter_connected(uint8_t host_idx) {
-    kc_printf("wireless_connected %d\n\r", host_idx);
+    trace_event(TRACE_WIRELESS_CONNECTED, host_idx, 0);
+    link_stats_connected();
 
     wireless_state = WT_CONNECTED;
     indicator_set(wireless_state, host_idx);
@@ -239,7 +243,7 @@ static void wireless_enter_connected(uint8_t host_idx) {
  *   - set disconnected indication
  */
 static void wireless_enter_disconnected(uint8_t host_idx, uint8_t reason) {
-    kc_printf("wireless_disconnected %d, %d\n\r", host_idx, reason);
+    trace_event(TRACE_WIRELESS_DISCONNECTED, host_idx, reason);
 
     uint8_t previous_state = wireless_state;
     led_state              = 0;
@@ -249,6 +253,7 @@ static void wireless_enter_disconnected(uint8_t host_idx, uint8_t reason) {
     wireless_state = WT_DISCONNECTED;
 
     if (previous_state == WT_CONNECTED) {
+        link_stats_disconnected();
         lpm_timer_reset();
         indicator_set(WT_SUSPEND, host_idx);
     } else {
@@ -262,7 +267,6 @@ static void wireless_enter_disconnected(uint8_t host_idx, uint8_t reason) {
 #ifndef DISABLE_REPORT_BUFFER
     report_buffer_init();
 #endif
-    retry = 0;
     wireless_enter_disconnected_kb(host_idx, reason);
 
     indicator_battery_low_enable(false);
@@ -291,13 +295,13 @@ static void wireless_exit_bluetooth_pin_code_entry(void) {
  *   - set disconnected indication
  */
 static void wireless_enter_sleep(void) {
-    kc_printf("wireless_enter_sleep %d\n\r", wireless_state);
+    trace_event(TRACE_WIRELESS_SLEEP, wireless_state, 0);
 
     led_state = 0;
 
     if (wireless_state == WT_CONNECTED || wireless_state == WT_PARING) {
         wireless_state = WT_SUSPEND;
-        kc_printf("WT_SUSPEND\n\r");
+        trace_event(TRACE_WIRELESS_SUSPEND, 0, 0);
         lpm_timer_reset();
 
         wireless_enter_sleep_kb();
@@ -330,6 +334,21 @@ uint8_t wreless_keyboard_leds(void) {
 
 extern keymap_config_t keymap_config;
 
+/* Reports of every class go through the report buffer, so they reach the
+ * host in the order they were made and at the pace the link can take */
+static void wireless_send_report(report_buffer_t *report) {
+#ifndef DISABLE_REPORT_BUFFER
+    bool empty = report_buffer_is_empty();
+
+    report_buffer_enqueue(report);
+
+    if (empty)
+        report_buffer_task();
+#else
+    report_buffer_send(report);
+#endif
+}
+
 void wireless_send_keyboard(report_keyboard_t *report) {
     if (battery_is_critical_low()) return;
 
@@ -337,19 +356,10 @@ void wireless_send_keyboard(report_keyboard_t *report) {
 
     if (wireless_state == WT_CONNECTED || (wireless_state == WT_PARING && pincodeEntry)) {
         if (wireless_transport.send_keyboard) {
-#ifndef DISABLE_REPORT_BUFFER
-            bool empty = report_buffer_is_empty();
-
             report_buffer_t report_buffer;
             report_buffer.type = REPORT_TYPE_KB;
             memcpy(&report_buffer.keyboard, report, sizeof(report_keyboard_t));
-            report_buffer_enqueue(&report_buffer);
-
-            if (empty)
-                report_buffer_task();
-#else
-            wireless_transport.send_keyboard(&report->mods);
-#endif
+            wireless_send_report(&report_buffer);
         }
     } else if (wireless_state != WT_RESET) {
         wireless_connect();
@@ -363,19 +373,10 @@ void wireless_send_nkro(report_nkro_t *report) {
 
     if (wireless_state == WT_CONNECTED || (wireless_state == WT_PARING && pincodeEntry)) {
         if (wireless_transport.send_nkro) {
-#ifndef DISABLE_REPORT_BUFFER
-            bool empty = report_buffer_is_empty();
-
             report_buffer_t report_buffer;
             report_buffer.type = REPORT_TYPE_NKRO;
             memcpy(&report_buffer.nkro, report, sizeof(report_nkro_t));
-            report_buffer_enqueue(&report_buffer);
-
-            if (empty)
-                report_buffer_task();
-#else
-            wireless_transport.send_nkro(&report->mods);
-#endif
+            wireless_send_report(&report_buffer);
         }
     } else if (wireless_state != WT_RESET) {
         wireless_connect();
@@ -386,7 +387,12 @@ void wireless_send_mouse(report_mouse_t *report) {
     if (battery_is_critical_low()) return;
 
     if (wireless_state == WT_CONNECTED) {
-        if (wireless_transport.send_mouse) wireless_transport.send_mouse((uint8_t *)report);
+        if (wireless_transport.send_mouse) {
+            report_buffer_t report_buffer;
+            report_buffer.type = REPORT_TYPE_MOUSE;
+            memcpy(&report_buffer.mouse, report, sizeof(report_mouse_t));
+            wireless_send_report(&report_buffer);
+        }
     } else if (wireless_state != WT_RESET) {
         wireless_connect();
     }
@@ -394,7 +400,12 @@ void wireless_send_mouse(report_mouse_t *report) {
 
 void wireless_send_system(uint16_t data) {
     if (wireless_state == WT_CONNECTED) {
-        if (wireless_transport.send_system) wireless_transport.send_system(data);
+        if (wireless_transport.send_system) {
+            report_buffer_t report_buffer;
+            report_buffer.type   = REPORT_TYPE_SYSTEM;
+            report_buffer.system = data;
+            wireless_send_report(&report_buffer);
+        }
     } else if (wireless_state != WT_RESET) {
         wireless_connect();
     }
@@ -402,19 +413,12 @@ void wireless_send_system(uint16_t data) {
 
 void wireless_send_consumer(uint16_t data) {
     if (wireless_state == WT_CONNECTED) {
-#ifndef DISABLE_REPORT_BUFFER
-        if (report_buffer_is_empty() && report_buffer_next_inverval()) {
-            if (wireless_transport.send_consumer) wireless_transport.send_consumer(data);
-            report_buffer_update_timer();
-        } else {
+        if (wireless_transport.send_consumer) {
             report_buffer_t report_buffer;
             report_buffer.type     = REPORT_TYPE_CONSUMER;
             report_buffer.consumer = data;
-            report_buffer_enqueue(&report_buffer);
+            wireless_send_report(&report_buffer);
         }
-#else
-        if (wireless_transport.send_consumer) wireless_transport.send_consumer(data);
-#endif
     } else if (wireless_state != WT_RESET) {
         wireless_connect();
     }
@@ -430,33 +434,44 @@ void wireless_send_extra(report_extra_t *report) {
     }
 }
 
+static bool     low_bat_shutdown       = false;
+static uint32_t low_bat_shutdown_timer = 0;
+
+/* Release everything on the host through the report buffer, the disconnect
+ * follows from wireless_low_battery_shutdown_task() once the releases are acked */
 void wireless_low_battery_shutdown(void) {
+    report_buffer_t report_buffer;
+
     indicator_battery_low_enable(false);
 
+    report_buffer_init(); // Drop queued reports, the releases below supersede them
+    clear_keyboard();
 
-    report_buffer_init();
-    clear_keyboard(); //
-    wait_ms(50);      // wait a while for bt module to free buffer by sending report
-
-    // Release all keys by sending empty reports
-    if (keymap_config.nkro) {
-        report_nkro_t empty_nkro_report;
-        memset(&empty_nkro_report, 0, sizeof(empty_nkro_report));
-        wireless_transport.send_nkro(&empty_nkro_report.mods);
-    } else {
-        report_keyboard_t empty_report;
-        memset(&empty_report, 0, sizeof(empty_report));
-        wireless_transport.send_keyboard(&empty_report.mods);
-    }
-    wait_ms(10);
-    wireless_transport.send_consumer(0);
-    wait_ms(10);
-    report_mouse_t empty_mouse_report;
-    memset(&empty_mouse_report, 0, sizeof(empty_mouse_report));
-    wireless_transport.send_mouse((uint8_t *)&empty_mouse_report);
-    wait_ms(300); // Wait for bt module to send all buffered report
+    // wireless_send_* refuse to send at critical low, so queue the releases here
+    memset(&report_buffer, 0, sizeof(report_buffer));
+    report_buffer.type = keymap_config.nkro ? REPORT_TYPE_NKRO : REPORT_TYPE_KB;
+    wireless_send_report(&report_buffer);
+    report_buffer.type = REPORT_TYPE_CONSUMER;
+    wireless_send_report(&report_buffer);
+    report_buffer.type = REPORT_TYPE_SYSTEM;
+    wireless_send_report(&report_buffer);
+    report_buffer.type = REPORT_TYPE_MOUSE;
+    wireless_send_report(&report_buffer);
+
+    low_bat_shutdown       = true;
+    low_bat_shutdown_timer = timer_read32();
+}
+
+static void wireless_low_battery_shutdown_task(void) {
+    if (!low_bat_shutdown) return;
+
+    if (wireless_state == WT_CONNECTED && (!report_buffer_is_empty() || report_buffer_inflight()) && timer_elapsed32(low_bat_shutdown_timer) < LOW_BAT_SHUTDOWN_TIMEOUT_MS) return;
+
+    low_bat_shutdown = false;
 
+    loop_monitor_block_begin(LOOP_SITE_LOW_BAT_SHUTDOWN);
     wireless_disconnect();
+    loop_monitor_block_end();
 }
 
 void wireless_event_task(void) {
@@ -508,9 +523,9 @@ void wireless_task(void) {
 #ifndef DISABLE_REPORT_BUFFER
     report_buffer_task();
 #endif
-    indicator_task();
-    keychron_wireless_common_task();
+    wireless_low_battery_shutdown_task();
     battery_task();
+    energy_task();
     lpm_task();
 }
 
@@ -19,17 +19,17 @@
 #include "wireless_event_type.h"
 #include "action.h"
 
-#ifdef KC_DEBUG
-#    define kc_printf dprintf
-#else
-#    define kc_printf(format, ...)
-#endif
-
 /* Low power mode */
 #ifndef LOW_POWER_MODE
 #    define LOW_POWER_MODE PM_STOP
 #endif
 
+/* Longest wait for the release reports to be acked before disconnecting on
+ * a critical low battery */
+#ifndef LOW_BAT_SHUTDOWN_TIMEOUT_MS
+#    define LOW_BAT_SHUTDOWN_TIMEOUT_MS 500
+#endif
+
 /* Wake pin used for blueooth module/controller to wake up MCU in low power mode*/
 #ifndef BLUETOOTH_INT_INPUT_PIN
 #    define WAKE_PIN A5
@@ -61,6 +61,7 @@ typedef struct {
     void (*send_mouse)(uint8_t *);
     void (*update_bat_level)(uint8_t);
     void (*task)(void);
+    uint8_t (*last_sn)(void); // Sequence number of the last frame sent, used to count the frames of a report
 } wt_func_t;
 // clang-format on
 
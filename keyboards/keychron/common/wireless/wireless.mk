@@ -12,12 +12,17 @@ SRC += \
      $(WIRELESS_DIR)/report_buffer.c \
      $(WIRELESS_DIR)/lkbt51.c \
      $(WIRELESS_DIR)/indicator.c \
+     $(WIRELESS_DIR)/indicator_pattern.c \
      $(WIRELESS_DIR)/wireless_main.c \
      $(WIRELESS_DIR)/transport.c \
      $(WIRELESS_DIR)/lpm.c \
      $(WIRELESS_DIR)/battery.c \
      $(WIRELESS_DIR)/bat_level_animation.c \
      $(WIRELESS_DIR)/rtc_timer.c \
+     $(WIRELESS_DIR)/energy.c \
+     $(WIRELESS_DIR)/link_stats.c \
+     $(WIRELESS_DIR)/trace.c \
+     $(WIRELESS_DIR)/loop_monitor.c \
      $(WIRELESS_DIR)/keychron_wireless_common.c
 
 ifeq ($(strip $(MCU)), STM32F401)
@@ -19,11 +19,13 @@
 #include "transport.h"
 #include "factory_test.h"
 #include "keychron_task.h"
+#include "loop_monitor.h"
 
 __attribute__((weak)) void wireless_pre_task(void) {}
 __attribute__((weak)) void wireless_post_task(void) {}
 
 bool wireless_tasks(void) {
+    loop_monitor_task();
     wireless_pre_task();
     wireless_task();
     wireless_post_task();
@@ -21,6 +21,9 @@
 #undef RGB_MATRIX_DEFAULT_MODE
 #define RGB_MATRIX_DEFAULT_MODE RGB_MATRIX_CUSTOM_bz_ripple
 
+/* EEPROM space for macros uploaded over raw HID or recorded on the keyboard */
+#define EECONFIG_USER_DATA_SIZE 512
+
 #ifndef NO_DEBUG
 #define NO_DEBUG
 #endif // !NO_DEBUG
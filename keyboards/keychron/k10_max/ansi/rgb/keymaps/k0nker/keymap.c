@@ -23,6 +23,8 @@
 #include "keychron_common.h"
 #include "ripples.h"
 #include "macro.h"
+#include "macro_store.h"
+#include "profiler.h"
 
 #define LAYER_CYCLE_START 0
 #define LAYER_CYCLE_END 4
@@ -33,7 +35,6 @@ uint8_t  ripple_frame         = 255;
 ripple_t ripples[MAX_RIPPLES] = {0};
 uint16_t r = 0, g = 0, b = 0;
 
-uint16_t macro_pulse = 0;
 uint16_t macro_ripple = 0;
 
 // A table of the LED int number for each key in rgb index.
@@ -59,7 +60,7 @@ const uint16_t PROGMEM keymaps[][MATRIX_ROWS][MATRIX_COLS] = {
         KC_LCTL,  KC_LOPTN, KC_LCMMD,                               KC_SPC,                                 KC_RCMMD, KC_ROPTN, MO(MAC_FN), KC_RCTL,    KC_LEFT,  KC_DOWN,  KC_RGHT,  KC_P0,              KC_PDOT,  KC_PENT),
 
     [MAC_FN] = LAYOUT_ansi_108(
-        _______,            KC_BRID,  KC_BRIU,  KC_MCTRL, KC_LNPAD, RGB_VAD,  RGB_VAI,  KC_MPRV,  KC_MPLY,  KC_MNXT,  KC_MUTE,  KC_VOLD,    KC_VOLU,    _______,  _______,  RGB_TOG,  _______,  _______,  _______,  _______,
+        _______,            KC_BRID,  KC_BRIU,  KC_MCTRL, KC_LNPAD, RGB_VAD,  RGB_VAI,  KC_MPRV,  KC_MPLY,  KC_MNXT,  KC_MUTE,  KC_VOLD,    KC_VOLU,    BZ_REC,   _______,  RGB_TOG,  BZ_USR1,  BZ_USR2,  BZ_USR3,  BZ_USR4,
         _______,  BT_HST1,  BT_HST2,  BT_HST3,  P2P4G,    _______,  _______,  _______,  _______,  _______,  _______,  _______,  _______,    _______,    _______,  _______,  _______,  _______,  _______,  _______,  _______,
         RGB_TOG,  RGB_MOD,  RGB_VAI,  RGB_HUI,  RGB_SAI,  RGB_SPI,  _______,  _______,  _______,  _______,  _______,  _______,  _______,    _______,    _______,  _______,  _______,  _______,  _______,  _______,
         _______,  RGB_RMOD, RGB_VAD,  RGB_HUD,  RGB_SAD,  RGB_SPD,  _______,  _______,  _______,  _______,  _______,  _______,              _______,                                  _______,  _______,  _______,  _______,
@@ -75,7 +76,7 @@ const uint16_t PROGMEM keymaps[][MATRIX_ROWS][MATRIX_COLS] = {
         KC_LWIN,  KC_LALT,  KC_LCTL,                                KC_SPC,                                 KC_RALT,  KC_RWIN,  MO(WIN_FN), KC_RCTL,    KC_LEFT,  KC_DOWN,  KC_RGHT,  KC_P0,              KC_PDOT,  KC_PENT),
 
     [WIN_FN] = LAYOUT_ansi_108(
-        _______,            KC_BRID,  KC_BRIU,  KC_TASK,  KC_FILE,  RGB_VAD,  RGB_VAI,  KC_MPRV,  KC_MPLY,  KC_MNXT,  KC_MUTE,  KC_VOLD,    KC_VOLU,    _______,  _______,  RGB_TOG,  _______,  _______,  _______,  KC_NO,
+        _______,            KC_BRID,  KC_BRIU,  KC_TASK,  KC_FILE,  RGB_VAD,  RGB_VAI,  KC_MPRV,  KC_MPLY,  KC_MNXT,  KC_MUTE,  KC_VOLD,    KC_VOLU,    BZ_REC,   _______,  RGB_TOG,  BZ_USR1,  BZ_USR2,  BZ_USR3,  BZ_USR4,
         _______,  BT_HST1,  BT_HST2,  BT_HST3,  P2P4G,    _______,  _______,  _______,  _______,  _______,  _______,  _______,  _______,    _______,    _______,  _______,  _______,  _______,  _______,  _______,  _______,
         RGB_TOG,  RGB_MOD,  RGB_VAI,  RGB_HUI,  RGB_SAI,  RGB_SPI,  _______,  _______,  _______,  _______,  _______,  _______,  _______,    _______,    _______,  _______,  _______,  _______,  _______,  _______,
         _______,  RGB_RMOD, RGB_VAD,  RGB_HUD,  RGB_SAD,  RGB_SPD,  _______,  _______,  _______,  _______,  _______,  _______,              _______,                                  _______,  _______,  _______,  _______,
@@ -141,56 +142,50 @@ void add_ripple_for_keyrecord(uint8_t trow, uint8_t tcol) {
 }
 
 /*
- * This is where you can set what type of macro each keycode will run.
- * You can set it to toggle, hold, or run once by placing the keycode
- * below the appropriate case statement:
- * - RESERVE_TOGGLE: The macro will toggle on and off when the key is pressed.
- * - RESERVE_HOLD: The macro will run while the key is held down and stop when released.
- * - RESERVE_ONCE: The macro will run once when the key is pressed and will not repeat.
+ * Macro keycodes are looked up in `macro_table` (see macro.c), which also holds
+ * whether each macro is a toggle, hold, or run-once macro.
+ * Fn + Print Screen starts recording, then a macro key (Fn + the four keys
+ * above the numpad hold the free BZ_USR slots) stores it there.
  */
 bool process_record_user(uint16_t kc, keyrecord_t *rc) {
+    PROFILE_SCOPE(PROFILE_PROCESS_RECORD);
+
     if (rc->event.pressed) {
         macro_ripple = timer_read();
         add_ripple_for_keyrecord(rc->event.key.row, rc->event.key.col);
     }
-    switch (kc) {
-        // Put all TOGGLE macros here
-        case RESERVE_TOGGLE:
-        case BZ_MBTN1:
-        case BZ_MBTN2:
-        case BZ_EQLS:
-        case BZ_NO3:
-        case BZ_Test:
-            if (rc->event.pressed) {
-                if (bz_macro.active && bz_macro.btn == kc) {
-                    macro_setup(&bz_macro, kc, false, MACRO_TOGGLE, rc->event.key.row, rc->event.key.col);
-                } else {
-                    macro_setup(&bz_macro, kc, true, MACRO_TOGGLE, rc->event.key.row, rc->event.key.col);
+
+    if (!macro_record_process(kc, rc)) {
+        return false;
+    }
+
+    const macro_table_entry_t *macro = macro_get(kc);
+    if (macro) {
+        macro_state_t *running = macro_find(kc);
+
+        switch (macro->type) {
+            case MACRO_HOLD:
+                if (rc->event.pressed && !running) {
+                    macro_start(kc, MACRO_HOLD, rc->event.key.row, rc->event.key.col);
+                } else if (!rc->event.pressed && running) {
+                    macro_stop(running);
                 }
-            }
-            return false;
-        // Put all HOLD macros here
-        case RESERVE_HOLD:
-            if (rc->event.pressed) {
-                macro_setup(&bz_macro, kc, true, MACRO_HOLD, rc->event.key.row, rc->event.key.col);
-            } else {
-                macro_setup(&bz_macro, kc, false, MACRO_HOLD, rc->event.key.row, rc->event.key.col);
-            }
-            return false;
-        // Put all RUN ONCE macros here
-        case RESERVE_ONCE:
-        case BZ_LOVE:
-            if (rc->event.pressed) {
-                if (bz_macro.active && bz_macro.btn == kc) {
-                    macro_setup(&bz_macro, kc, false, MACRO_ONCE, rc->event.key.row, rc->event.key.col);
-                } else {
-                    macro_setup(&bz_macro, kc, true, MACRO_ONCE, rc->event.key.row, rc->event.key.col);
+                break;
+            case MACRO_TOGGLE:
+            case MACRO_ONCE:
+            default:
+                if (rc->event.pressed) {
+                    if (running) {
+                        macro_stop(running);
+                    } else {
+                        macro_start(kc, macro->type, rc->event.key.row, rc->event.key.col);
+                    }
                 }
-            }
-            return false;
-        default:
-            break;
+                break;
+        }
+        return false;
     }
+
     if (!process_record_keychron_common(kc, rc)) {
         return false;
     }
@@ -198,21 +193,30 @@ bool process_record_user(uint16_t kc, keyrecord_t *rc) {
     return true;
 }
 
+void keyboard_post_init_user(void) {
+    macro_store_init();
+}
+
 void matrix_scan_user(void) {
-    if (bz_macro.active && timer_elapsed(macro_pulse) >= 10) {
-        macro_runner(&bz_macro);
-        macro_pulse = timer_read();
+    if (macro_any_active()) {
+        macro_task();
         if (timer_elapsed(macro_ripple) >= 1500) {
-            add_ripple_for_keyrecord(bz_macro.row, bz_macro.col);
+            for (uint8_t i = 0; i < MACRO_SLOT_COUNT; i++) {
+                if (macro_slots[i].active) add_ripple_for_keyrecord(macro_slots[i].row, macro_slots[i].col);
+            }
             macro_ripple = timer_read();
         }
     }
 }
 
 bool rgb_matrix_indicators_advanced_user(uint8_t led_min, uint8_t led_max) {
+    PROFILE_SCOPE(PROFILE_RGB_INDICATORS);
+
     uint8_t v = rgb_matrix_config.hsv.v;
-    if (bz_macro.active) {
-        rgb_matrix_set_color(g_led_config.matrix_co[bz_macro.row][bz_macro.col], RGB_RED);
+    for (uint8_t i = 0; i < MACRO_SLOT_COUNT; i++) {
+        if (macro_slots[i].active) {
+            rgb_matrix_set_color(g_led_config.matrix_co[macro_slots[i].row][macro_slots[i].col], RGB_RED);
+        }
     }
     if (get_highest_layer(layer_state) > 0) {
         uint8_t layer = get_highest_layer(layer_state);
@@ -1,174 +1,516 @@
+#include <string.h>
 #include QMK_KEYBOARD_H
 #include "keychron_common.h"
 #include "macro.h"
+#include "macro_store.h"
+#include "soft_timer.h"
+#ifdef LK_WIRELESS_ENABLE
+#    include "transport.h"
+#    include "report_buffer.h"
+#endif
 
-macro_state_t bz_macro = {0};
+macro_state_t macro_slots[MACRO_SLOT_COUNT] = {0};
 
-void macro_setup(macro_state_t *ma, uint16_t keycode, bool activate, uint8_t type, uint8_t row, uint8_t col) {
-    bz_macro.active = false; // Deactivate any currently active macro
-    if (activate) {
-        ma->btn    = keycode;
-        ma->type   = type;
-        ma->step   = 0;
-        ma->delay  = 0;
-        ma->timer  = timer_read();
-        ma->active = true;
-        ma->row    = row;
-        ma->col    = col;
-    } else {
-        ma->active = false;
-        ma->btn    = 0;
-        ma->step   = 0;
-        ma->delay  = 0;
+/* Indexes of the active slots, ordered by the time their next step is due */
+static uint8_t macro_queue[MACRO_SLOT_COUNT];
+static uint8_t macro_queue_len = 0;
+
+/* Armed for the head of the queue, so a throttled main loop wakes up in time */
+static soft_timer_t macro_timer;
+
+/* Characters per second of the last string a macro finished typing */
+static uint16_t macro_typing_rate = 0;
+
+/*
+ * Strings typed by the macros below with M_STR(). Keep the programs themselves
+ * free of text so they stay compact.
+ */
+enum macro_string_ids {
+    STR_TEST_END,
+    STR_WRAP_UP,
+    STR_LOVE,
+    STR_YOU,
+};
+
+// clang-format off
+static const char *const macro_strings[] = {
+    [STR_TEST_END] = "st!",
+    [STR_WRAP_UP]  = " Wrap up!",
+    [STR_LOVE]     = "love",
+    [STR_YOU]      = " you",
+};
+
+/*
+ * Macro programs. Each macro is a byte array of M_* instructions, see macro.h.
+ * A program runs until it reaches an M_DELAY or M_END, so never busy wait here.
+ * Don't forget to add new programs and their type to the `macro_table`.
+ */
+static const uint8_t PROGMEM macro_BZ_Test[] = {
+    M_CHORD(KC_LSFT, KC_T),
+    M_TAP(KC_E),
+    M_DELAY(1000),
+    M_STR(STR_TEST_END),
+    M_DELAY(2000),
+    M_STR(STR_WRAP_UP),
+    M_DELAY(1000),
+    // Select all with Ctrl on the Windows layers, with GUI on any other
+    M_IF_LAYER(2, 3, M_CHORD_LEN),
+    M_CHORD(KC_LCTL, KC_A),
+    M_IF_LAYER(0, 1, M_CHORD_LEN),
+    M_CHORD(KC_LGUI, KC_A),
+    M_IF_LAYER(4, 255, M_CHORD_LEN),
+    M_CHORD(KC_LGUI, KC_A),
+    M_TAP(KC_DEL),
+    M_DELAY(1000),
+    M_END,
+};
+
+static const uint8_t PROGMEM macro_BZ_LOVE[] = {
+    M_STR(STR_LOVE),
+    M_DELAY(1000),
+    M_STR(STR_YOU),
+    M_DELAY(1000),
+    M_END,
+};
+
+static const uint8_t PROGMEM macro_BZ_MBTN1[] = {
+    M_TAP(KC_MS_BTN1),
+    M_END,
+};
+
+static const uint8_t PROGMEM macro_BZ_MBTN2[] = {
+    M_TAP(KC_MS_BTN2),
+    M_END,
+};
+
+static const uint8_t PROGMEM macro_BZ_EQLS[] = {
+    M_TAP(KC_EQUAL),
+    M_END,
+};
+
+static const uint8_t PROGMEM macro_BZ_NO3[] = {
+    M_TAP(KC_3),
+    M_END,
+};
+
+/*
+ * This is where you set what type of macro each keycode will run:
+ * - MACRO_TOGGLE: The macro will toggle on and off when the key is pressed.
+ * - MACRO_HOLD: The macro will run while the key is held down and stop when released.
+ * - MACRO_ONCE: The macro will run once when the key is pressed and will not repeat.
+ */
+static const macro_table_entry_t macro_table[MACRO_COUNT] = {
+    [BZ_Test  - MACRO_KEYCODE_FIRST] = {MACRO_TOGGLE, macro_BZ_Test   },
+    [BZ_LOVE  - MACRO_KEYCODE_FIRST] = {MACRO_ONCE,   macro_BZ_LOVE   },
+    [BZ_MBTN1 - MACRO_KEYCODE_FIRST] = {MACRO_TOGGLE, macro_BZ_MBTN1  },
+    [BZ_MBTN2 - MACRO_KEYCODE_FIRST] = {MACRO_TOGGLE, macro_BZ_MBTN2  },
+    [BZ_EQLS  - MACRO_KEYCODE_FIRST] = {MACRO_TOGGLE, macro_BZ_EQLS   },
+    [BZ_NO3   - MACRO_KEYCODE_FIRST] = {MACRO_TOGGLE, macro_BZ_NO3    },
+};
+// clang-format on
+
+const macro_table_entry_t *macro_get(uint16_t keycode) {
+    if (keycode < MACRO_KEYCODE_FIRST || keycode >= MACRO_KEYCODE_LAST) return NULL;
+
+    // Uploaded and recorded macros override the built-in ones
+    const macro_table_entry_t *user = macro_store_get(keycode);
+    if (user) return user;
+
+    const macro_table_entry_t *entry = &macro_table[keycode - MACRO_KEYCODE_FIRST];
+    return entry->program ? entry : NULL;
+}
+
+uint16_t macro_get_typing_rate(void) {
+    return macro_typing_rate;
+}
+
+/* Bytes taken by the operands of each opcode, inline strings excepted */
+// clang-format off
+static const uint8_t macro_operand_len[] = {
+    [MACRO_OP_END]        = 0,
+    [MACRO_OP_TAP]        = 1,
+    [MACRO_OP_DOWN]       = 1,
+    [MACRO_OP_UP]         = 1,
+    [MACRO_OP_STR_INLINE] = 0,
+    [MACRO_OP_STR_INDEX]  = 1,
+    [MACRO_OP_DELAY]      = 2,
+    [MACRO_OP_IF_LAYER]   = 3,
+    [MACRO_OP_LOOP]       = 2,
+};
+// clang-format on
+
+static bool macro_is_start(const uint8_t *starts, uint16_t pc) {
+    return starts[pc / 8] & (1 << (pc % 8));
+}
+
+/*
+ * Check a program from an untrusted source before it is run. The program is
+ * walked one instruction at a time: every opcode must be known, its operands
+ * must fit, string indexes must exist, skips must land on an instruction
+ * and loops must jump back to one. The only M_END allowed is the last byte.
+ * A macro has a single loop counter, so loops may not nest and a skip may
+ * not leave a loop body.
+ */
+bool macro_validate(const uint8_t *program, uint8_t len) {
+    uint8_t starts[(MACRO_PROGRAM_MAX + 7) / 8] = {0}; // Bit per instruction start
+    uint8_t pc                                  = 0;
+
+    if (len == 0) return false;
+
+    // Operands and the END position
+    while (true) {
+        uint8_t op = program[pc];
+
+        if (op >= ARRAY_SIZE(macro_operand_len)) return false;
+        starts[pc / 8] |= 1 << (pc % 8);
+        if (op == MACRO_OP_END) break;
+
+        if (op == MACRO_OP_STR_INLINE) {
+            const uint8_t *nul = memchr(&program[pc + 1], '\0', len - pc - 1);
+            if (!nul) return false;
+            pc = nul - program + 1;
+        } else {
+            if (len - pc - 1 < macro_operand_len[op]) return false;
+            if (op == MACRO_OP_STR_INDEX && program[pc + 1] >= ARRAY_SIZE(macro_strings)) return false;
+            pc += 1 + macro_operand_len[op];
+        }
+        if (pc >= len) return false; // Ran off the end without an END
+    }
+    if (pc != len - 1) return false;
+
+    // Jump targets, now that every instruction start is known
+    for (pc = 0; pc < len - 1; pc++) {
+        if (!macro_is_start(starts, pc)) continue;
+
+        if (program[pc] == MACRO_OP_IF_LAYER) {
+            uint16_t target = pc + 4 + program[pc + 3];
+
+            if (target >= len || !macro_is_start(starts, target)) return false;
+        } else if (program[pc] == MACRO_OP_LOOP) {
+            if (program[pc + 2] > pc) return false; // Body starts before the program
+
+            uint8_t body = pc - program[pc + 2];
+            if (!macro_is_start(starts, body)) return false;
+
+            for (uint8_t i = body; i < pc; i++) {
+                if (!macro_is_start(starts, i)) continue;
+                if (program[i] == MACRO_OP_LOOP) return false;
+                if (program[i] == MACRO_OP_IF_LAYER && i + 4 + program[i + 3] > pc) return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Whether there is room to send more reports. Over USB reports go out
+ * directly, over wireless they are queued in the report buffer, which
+ * drops reports once it is full.
+ */
+static bool macro_link_ready(void) {
+#ifdef LK_WIRELESS_ENABLE
+    if (get_transport() & TRANSPORT_WIRELESS) {
+        return report_buffer_free() >= MACRO_REPORT_HEADROOM;
+    }
+#endif
+    return true;
+}
+
+/*
+ * Remember the keys a program holds down, so a macro stopped between its
+ * M_DOWN and M_UP does not leave them stuck on the host.
+ */
+static void macro_hold(macro_state_t *ma, uint8_t kc) {
+    for (uint8_t i = 0; i < MACRO_HELD_MAX; i++) {
+        if (ma->held[i] == kc) return;
+    }
+    for (uint8_t i = 0; i < MACRO_HELD_MAX; i++) {
+        if (ma->held[i] == KC_NO) {
+            ma->held[i] = kc;
+            return;
+        }
     }
 }
 
+static void macro_unhold(macro_state_t *ma, uint8_t kc) {
+    for (uint8_t i = 0; i < MACRO_HELD_MAX; i++) {
+        if (ma->held[i] == kc) ma->held[i] = KC_NO;
+    }
+}
+
+static bool macro_held_elsewhere(macro_state_t *ma, uint8_t kc) {
+    for (uint8_t slot = 0; slot < MACRO_SLOT_COUNT; slot++) {
+        macro_state_t *other = &macro_slots[slot];
+        if (other == ma || !other->active) continue;
+        for (uint8_t i = 0; i < MACRO_HELD_MAX; i++) {
+            if (other->held[i] == kc) return true;
+        }
+    }
+    return false;
+}
+
+/* Release what the macro still holds, unless another running macro holds it too */
+static void macro_release_held(macro_state_t *ma) {
+    for (uint8_t i = 0; i < MACRO_HELD_MAX; i++) {
+        uint8_t kc = ma->held[i];
+        if (kc == KC_NO) continue;
+        ma->held[i] = KC_NO;
+        if (!macro_held_elsewhere(ma, kc)) unregister_code(kc);
+    }
+}
+
+static void macro_backoff(macro_state_t *ma) {
+    ma->due = timer_read32() + MACRO_BACKOFF_MS;
+}
+
+/*
+ * Type `str` one character at a time starting at ma->str_pos. Returns false
+ * if the link is busy, in which case typing resumes from the same character
+ * the next time the macro runs.
+ */
+static bool macro_type_string(macro_state_t *ma, const char *str, bool progmem) {
+    if (ma->str_pos == 0) ma->str_timer = timer_read32();
+
+    while (true) {
+        char c = progmem ? pgm_read_byte(&str[ma->str_pos]) : str[ma->str_pos];
+
+        if (c == '\0') break;
+        if (!macro_link_ready()) return false;
+
+        send_char(c);
+        ma->str_pos++;
+    }
+
+    uint32_t elapsed = timer_elapsed32(ma->str_timer);
+    if (ma->str_pos > 1 && elapsed) {
+        macro_typing_rate = (uint32_t)ma->str_pos * 1000 / elapsed;
+        dprintf("macro: typed %u chars at %u cps\n", ma->str_pos, macro_typing_rate);
+    }
+    ma->str_pos = 0;
+    return true;
+}
+
+/*
+ * Schedule the next step `delay` ms after the one that just ran. Deadlines
+ * advance from the previous deadline rather than from now, so scan jitter
+ * does not add up over a repeating macro. A macro that has fallen more than
+ * a whole step behind is resynchronised instead of bursting to catch up.
+ */
 void macro_end_step(macro_state_t *ma, uint16_t delay, bool reset) {
-    ma->delay = delay;
-    ma->timer = timer_read();
-    ma->step++;
+    uint32_t now = timer_read32();
+
+    ma->due += delay;
+    if (timer_expired32(now, ma->due)) ma->due = now;
+
     if (reset) {
         if (ma->type == MACRO_ONCE) {
             ma->active = false; // Deactivate the macro after running once
         }
-        ma->step = 0;
+        if (TIMER_DIFF_32(ma->due, ma->started) < MACRO_RESTART_PERIOD) ma->due = ma->started + MACRO_RESTART_PERIOD;
+        ma->started = ma->due;
+        ma->pc      = 0;
+        ma->loop    = 0;
     }
 }
 
-bool macro_ready(macro_state_t *ma) {
-    if (timer_elapsed(ma->timer) >= ma->delay && ma->active == true)
-        return true;
-    else
-        return false;
-}
-
 /*
- * Macro runner functions for executing the macro steps. Each macro gets it's own function.
- * If a pause is needed, use `macro_end_step(ma, delay, reset)` to set the next step.
- * Do not add waits or sleeps in these functions, as it will block all other keyboard functions.
- * Don't forget to update the `macro_table` with the macro functions.
+ * Interpret the program of `ma` from its program counter until it yields on
+ * a delay or reaches the end. Dispatch is a single switch per instruction,
+ * so the cost per tick does not depend on how many macros are defined.
  */
-void macro_BZ_Test(macro_state_t *ma) {
-    switch (ma->step) {
-        case 0:
-            register_code(KC_LSFT);
-            SEND_STRING(SS_TAP(X_T));
-            unregister_code(KC_LSFT);
-            SEND_STRING(SS_TAP(X_E));
-            macro_end_step(ma, 1000, false);
-            break;
-        case 1:
-            SEND_STRING("st!");
-            macro_end_step(ma, 2000, false);
-            break;
-        case 2:
-            SEND_STRING(" Wrap up!");
-            macro_end_step(ma, 1000, false);
-            break;
-        case 3:
-            switch (get_highest_layer(layer_state | default_layer_state)) {
-                case 0:
-                case 1:
-                    SEND_STRING(SS_LGUI("a"));
-                    break;
-                case 2:
-                case 3:
-                    SEND_STRING(SS_LCTL("a"));
-                    break;
-                default:
-                    SEND_STRING(SS_LGUI("a"));
-                    break;
-            }
+void macro_runner(macro_state_t *ma) {
+    const uint8_t *prog = ma->program;
+
+    while (true) {
+        uint8_t start = ma->pc;
+        uint8_t op    = pgm_read_byte(&prog[ma->pc++]);
+
+        // Everything up to MACRO_OP_STR_INDEX sends reports, wait for room first
+        if (op >= MACRO_OP_TAP && op <= MACRO_OP_STR_INDEX && !macro_link_ready()) {
+            ma->pc = start;
+            macro_backoff(ma);
+            return;
+        }
 
-            SEND_STRING(SS_TAP(X_DEL));
-            macro_end_step(ma, 1000, false);
-            break;
-        default:
-            macro_end_step(ma, 0, true);
-            break;
+        switch (op) {
+            case MACRO_OP_TAP:
+                tap_code(pgm_read_byte(&prog[ma->pc++]));
+                break;
+            case MACRO_OP_DOWN: {
+                uint8_t kc = pgm_read_byte(&prog[ma->pc++]);
+                register_code(kc);
+                macro_hold(ma, kc);
+            } break;
+            case MACRO_OP_UP: {
+                uint8_t kc = pgm_read_byte(&prog[ma->pc++]);
+                unregister_code(kc);
+                macro_unhold(ma, kc);
+            } break;
+            case MACRO_OP_STR_INLINE: {
+                const char *str = (const char *)&prog[ma->pc];
+                if (!macro_type_string(ma, str, true)) {
+                    ma->pc = start;
+                    macro_backoff(ma);
+                    return;
+                }
+                ma->pc += strlen_P(str) + 1;
+            } break;
+            case MACRO_OP_STR_INDEX:
+                if (!macro_type_string(ma, macro_strings[pgm_read_byte(&prog[ma->pc])], false)) {
+                    ma->pc = start;
+                    macro_backoff(ma);
+                    return;
+                }
+                ma->pc++;
+                break;
+            case MACRO_OP_DELAY: {
+                uint16_t delay = pgm_read_byte(&prog[ma->pc]) | (pgm_read_byte(&prog[ma->pc + 1]) << 8);
+                ma->pc += 2;
+                macro_end_step(ma, delay, false);
+            }
+                return;
+            case MACRO_OP_IF_LAYER: {
+                uint8_t lo    = pgm_read_byte(&prog[ma->pc]);
+                uint8_t hi    = pgm_read_byte(&prog[ma->pc + 1]);
+                uint8_t skip  = pgm_read_byte(&prog[ma->pc + 2]);
+                uint8_t layer = get_highest_layer(layer_state | default_layer_state);
+                ma->pc += 3;
+                if (layer < lo || layer > hi) ma->pc += skip;
+            } break;
+            case MACRO_OP_LOOP: {
+                uint8_t count = pgm_read_byte(&prog[ma->pc]);
+                uint8_t body  = pgm_read_byte(&prog[ma->pc + 1]);
+                ma->pc += 2;
+                if (++ma->loop < count) {
+                    ma->pc -= body + 3;
+                } else {
+                    ma->loop = 0;
+                }
+            } break;
+            case MACRO_OP_END:
+            default:
+                macro_end_step(ma, 0, true);
+                return;
+        }
     }
 }
 
-void macro_BZ_LOVE(macro_state_t *ma) {
-    switch (ma->step) {
-        case 0:
-            SEND_STRING("love");
-            macro_end_step(ma, 1000, false);
-            break;
-        case 1:
-            SEND_STRING(" you");
-            macro_end_step(ma, 1000, false);
-            break;
-        default:
-            macro_end_step(ma, 0, true);
-            break;
+/* Insert a slot behind all slots due at or before it, keeping the queue ordered */
+static void macro_queue_insert(uint8_t slot) {
+    uint32_t due = macro_slots[slot].due;
+    uint8_t  i   = macro_queue_len;
+
+    while (i > 0 && (int32_t)(macro_slots[macro_queue[i - 1]].due - due) > 0) {
+        macro_queue[i] = macro_queue[i - 1];
+        i--;
     }
+    macro_queue[i] = slot;
+    macro_queue_len++;
 }
 
-void macro_BZ_MBTN1(macro_state_t *ma) {
-    switch (ma->step) {
-        case 0:
-            SEND_STRING(SS_TAP(X_MS_BTN1));
-            break;
-        default:
-            macro_end_step(ma, 0, true);
-            break;
+static void macro_queue_remove(uint8_t slot) {
+    for (uint8_t i = 0; i < macro_queue_len; i++) {
+        if (macro_queue[i] == slot) {
+            memmove(&macro_queue[i], &macro_queue[i + 1], macro_queue_len - i - 1);
+            macro_queue_len--;
+            return;
+        }
     }
 }
 
-void macro_BZ_MBTN2(macro_state_t *ma) {
-    switch (ma->step) {
-        case 0:
-            SEND_STRING(SS_TAP(X_MS_BTN2));
-            break;
-        default:
-            macro_end_step(ma, 0, true);
-            break;
+static void macro_timer_fired(void *arg) {
+    macro_task();
+}
+
+/* Follow the head of the queue with macro_timer. The soft timer deadline
+ * caps the low power throttle and keeps the MCU out of STOP mode while a
+ * macro runs */
+static void macro_timer_update(void) {
+    if (!macro_queue_len) {
+        soft_timer_stop(&macro_timer);
+        return;
     }
+
+    uint32_t due = macro_slots[macro_queue[0]].due;
+    uint32_t now = timer_read32();
+
+    soft_timer_start(&macro_timer, timer_expired32(now, due) ? 0 : TIMER_DIFF_32(due, now), macro_timer_fired, NULL);
 }
 
-void macro_BZ_EQLS(macro_state_t *ma) {
-    switch (ma->step) {
-        case 0:
-            SEND_STRING(SS_TAP(X_EQUAL));
-            break;
-        default:
-            macro_end_step(ma, 0, true);
-            break;
+macro_state_t *macro_start(uint16_t keycode, uint8_t type, uint8_t row, uint8_t col) {
+    const macro_table_entry_t *entry = macro_get(keycode);
+    if (!entry) return NULL;
+
+    for (uint8_t slot = 0; slot < MACRO_SLOT_COUNT; slot++) {
+        macro_state_t *ma = &macro_slots[slot];
+        if (ma->active) continue;
+
+        ma->program = entry->program;
+        ma->btn     = keycode;
+        ma->type    = type;
+        ma->pc      = 0;
+        ma->loop    = 0;
+        ma->str_pos = 0;
+        ma->due     = timer_read32();
+        ma->started = ma->due;
+        ma->active  = true;
+        ma->row     = row;
+        ma->col     = col;
+        memset(ma->held, KC_NO, sizeof(ma->held));
+        macro_queue_insert(slot);
+        macro_timer_update();
+        return ma;
     }
+
+    return NULL; // All slots are busy
+}
+
+void macro_stop(macro_state_t *ma) {
+    macro_queue_remove(ma - macro_slots);
+    macro_timer_update();
+    macro_release_held(ma);
+    ma->active  = false;
+    ma->btn     = 0;
+    ma->pc      = 0;
+    ma->loop    = 0;
+    ma->str_pos = 0;
 }
 
-void macro_BZ_NO3(macro_state_t *ma) {
-    switch (ma->step) {
-        case 0:
-            SEND_STRING(SS_TAP(X_3));
-            break;
-        default:
-            macro_end_step(ma, 0, true);
-            break;
+macro_state_t *macro_find(uint16_t keycode) {
+    for (uint8_t slot = 0; slot < MACRO_SLOT_COUNT; slot++) {
+        if (macro_slots[slot].active && macro_slots[slot].btn == keycode) return &macro_slots[slot];
     }
+    return NULL;
 }
 
-// clang-format off
-const macro_table_entry_t macro_table[] = {
-    {BZ_Test,       macro_BZ_Test   },
-    {BZ_LOVE,       macro_BZ_LOVE   },
-    {BZ_MBTN1,      macro_BZ_MBTN1  },
-    {BZ_MBTN2,      macro_BZ_MBTN2  },
-    {BZ_EQLS,       macro_BZ_EQLS   },
-    {BZ_NO3,        macro_BZ_NO3    },
-};
+bool macro_any_active(void) {
+    return macro_queue_len != 0;
+}
 
-// clang-format on
-const size_t macro_table_size = sizeof(macro_table) / sizeof(macro_table[0]);
+/*
+ * Run the macros that are due. Only the head of the queue is checked when
+ * nothing is due, and each slot runs at most once per call so that macros
+ * without delays cannot starve the rest of the keyboard.
+ */
+void macro_task(void) {
+    uint8_t budget = macro_queue_len;
 
-void macro_runner(macro_state_t *ma) {
-    if (macro_ready(ma)) {
-        for (size_t i = 0; i < macro_table_size; ++i) {
-            if (macro_table[i].keycode == ma->btn) {
-                macro_table[i].handler(ma);
-                return;
-            }
+    while (budget-- && macro_queue_len) {
+        uint8_t        slot = macro_queue[0];
+        macro_state_t *ma   = &macro_slots[slot];
+
+        if (!timer_expired32(timer_read32(), ma->due)) break;
+
+        macro_queue_remove(slot);
+        macro_runner(ma);
+
+        if (ma->active) {
+            macro_queue_insert(slot);
+        } else {
+            macro_stop(ma);
         }
     }
+
+    macro_timer_update();
 }
@@ -2,58 +2,120 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+/*
+ * Macros are stored as small bytecode programs. Each instruction is a one
+ * byte opcode followed by its operands. Programs are plain byte arrays, so
+ * they can live in flash or be loaded into RAM from EEPROM at runtime.
+ */
+enum macro_opcodes {
+    MACRO_OP_END = 0x00, // End of program: restart, or stop for MACRO_ONCE
+    MACRO_OP_TAP,        // kc            Tap a basic keycode
+    MACRO_OP_DOWN,       // kc            Register a basic keycode
+    MACRO_OP_UP,         // kc            Unregister a basic keycode
+    MACRO_OP_STR_INLINE, // chars..., 0   Type an inline NUL-terminated string
+    MACRO_OP_STR_INDEX,  // idx           Type a string from macro_strings[]
+    MACRO_OP_DELAY,      // lo, hi        Wait before running the next instruction
+    MACRO_OP_IF_LAYER,   // lo, hi, n     Skip the next n bytes unless the highest layer is within [lo, hi]
+    MACRO_OP_LOOP,       // count, n      Run the preceding n bytes count times, loops do not nest
+};
+
+// Helpers for writing programs in C
+#define M_END MACRO_OP_END
+#define M_TAP(kc) MACRO_OP_TAP, (kc)
+#define M_DOWN(kc) MACRO_OP_DOWN, (kc)
+#define M_UP(kc) MACRO_OP_UP, (kc)
+#define M_CHORD(mod, kc) M_DOWN(mod), M_TAP(kc), M_UP(mod)
+#define M_CHORD_LEN 6
+#define M_STR(idx) MACRO_OP_STR_INDEX, (idx)
+#define M_DELAY(ms) MACRO_OP_DELAY, ((ms) & 0xFF), (((ms) >> 8) & 0xFF)
+#define M_IF_LAYER(lo, hi, n) MACRO_OP_IF_LAYER, (lo), (hi), (n)
+#define M_LOOP(count, n) MACRO_OP_LOOP, (count), (n)
+
+// Keys a macro can hold down with M_DOWN at the same time, a 6KRO report's worth
+#ifndef MACRO_HELD_MAX
+#    define MACRO_HELD_MAX 6
+#endif
+
 // Macro state struct
 typedef struct {
-    bool     active;
-    uint8_t  type;
-    uint8_t  step;
-    uint16_t btn;
-    uint16_t timer;
-    uint16_t delay;
-    uint8_t  row;
-    uint8_t  col;
+    bool           active;
+    uint8_t        type;
+    uint8_t        pc;
+    uint8_t        loop;
+    uint16_t       btn;
+    uint32_t       due;     // timer_read32() time the next step runs at
+    uint32_t       started; // Deadline the current run of the program started at
+    uint8_t        row;
+    uint8_t        col;
+    uint16_t       str_pos;              // Next character of the string being typed
+    uint32_t       str_timer;            // When typing of that string started
+    uint8_t        held[MACRO_HELD_MAX]; // Keycodes down from M_DOWN, released when the macro stops
+    const uint8_t *program;
 } macro_state_t;
 
-// Macro handler function pointer type
-typedef void (*macro_handler_t)(macro_state_t *ma);
+// Number of macros that can run at the same time
+#ifndef MACRO_SLOT_COUNT
+#    define MACRO_SLOT_COUNT 4
+#endif
+
+/*
+ * Free report buffer entries required before a key instruction or string
+ * character is sent over wireless. A shifted character takes four reports.
+ */
+#ifndef MACRO_REPORT_HEADROOM
+#    define MACRO_REPORT_HEADROOM 8
+#endif
 
-// Macro table entry struct
+// Shortest period a repeating macro restarts at, for programs without a delay step
+#ifndef MACRO_RESTART_PERIOD
+#    define MACRO_RESTART_PERIOD 10
+#endif
+
+// How long a macro waits for the report buffer to drain before trying again
+#ifndef MACRO_BACKOFF_MS
+#    define MACRO_BACKOFF_MS 2
+#endif
+
+// Macro table entry struct, indexed by keycode - MACRO_KEYCODE_FIRST
 typedef struct {
-    uint16_t        keycode;
-    macro_handler_t handler;
+    uint8_t        type;
+    const uint8_t *program;
 } macro_table_entry_t;
 
-// Macro table and size
-extern const macro_table_entry_t macro_table[];
-extern const size_t macro_table_size;
-extern macro_state_t bz_macro;
+extern macro_state_t macro_slots[MACRO_SLOT_COUNT];
 
 // Macro helpers
-void macro_end_step(macro_state_t *ma, uint16_t delay, bool reset);
-bool macro_ready(macro_state_t *ma);
-void macro_runner(macro_state_t *ma);
-void macro_setup(macro_state_t *ma, uint16_t keycode, bool activate, uint8_t type, uint8_t row, uint8_t col);
-
-// Macro handler prototypes (optional, but helps with IDEs)
-void macro_BZ_Test(macro_state_t *ma);
-void macro_BZ_LOVE(macro_state_t *ma);
-void macro_BZ_MBTN1(macro_state_t *ma);
-void macro_BZ_MBTN2(macro_state_t *ma);
-void macro_BZ_EQLS(macro_state_t *ma);
-void macro_BZ_NO3(macro_state_t *ma);
+void                       macro_end_step(macro_state_t *ma, uint16_t delay, bool reset);
+void                       macro_runner(macro_state_t *ma);
+const macro_table_entry_t *macro_get(uint16_t keycode);
+bool                       macro_validate(const uint8_t *program, uint8_t len);
+uint16_t                   macro_get_typing_rate(void);
+
+// Macro scheduler
+macro_state_t *macro_start(uint16_t keycode, uint8_t type, uint8_t row, uint8_t col);
+void           macro_stop(macro_state_t *ma);
+macro_state_t *macro_find(uint16_t keycode);
+bool           macro_any_active(void);
+void           macro_task(void);
 
 enum custom_keycodes {
-    RESERVE_HOLD = SAFE_RANGE,
-    RESERVE_TOGGLE,
-    RESERVE_ONCE,
-    BZ_MBTN1,
+    MACRO_KEYCODE_FIRST = SAFE_RANGE,
+    BZ_MBTN1            = MACRO_KEYCODE_FIRST,
     BZ_MBTN2,
     BZ_NO3,
     BZ_EQLS,
     BZ_Test,
     BZ_LOVE,
+    BZ_USR1, // Free for macros uploaded over raw HID or recorded
+    BZ_USR2,
+    BZ_USR3,
+    BZ_USR4,
+    MACRO_KEYCODE_LAST,
+    BZ_REC = MACRO_KEYCODE_LAST, // Start/stop recording, see macro_store.h
 };
 
+#define MACRO_COUNT (MACRO_KEYCODE_LAST - MACRO_KEYCODE_FIRST)
+
 enum macro_types {
     MACRO_TOGGLE,
     MACRO_HOLD,
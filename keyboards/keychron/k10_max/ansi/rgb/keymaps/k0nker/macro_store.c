@@ -0,0 +1,323 @@
+#include <string.h>
+#include QMK_KEYBOARD_H
+#include "keychron_common.h"
+#include "macro_store.h"
+#ifdef RAW_ENABLE
+#    include "raw_hid.h"
+#endif
+
+_Static_assert(MACRO_STORE_SIZE > MACRO_RECORD_HEADER_LEN, "EECONFIG_USER_DATA_SIZE is too small for the macro store");
+
+/* RAM copy of the EEPROM datablock, stored programs run straight from here */
+static uint8_t             macro_store[MACRO_STORE_SIZE];
+static uint16_t            macro_store_end = 0;
+static macro_table_entry_t macro_user[MACRO_COUNT];
+static uint8_t             macro_user_len[MACRO_COUNT];
+
+/* Program being uploaded or recorded before it is written to the store */
+static uint8_t macro_stage[MACRO_PROGRAM_MAX];
+static uint8_t macro_stage_index = 0xFF;
+static uint8_t macro_stage_type  = MACRO_TOGGLE;
+static uint8_t macro_stage_len   = 0;
+
+static struct {
+    bool     active;
+    uint8_t  len;
+    uint32_t last;
+} macro_rec = {0};
+
+/*
+ * Index the records in macro_store, returns where the list ends. Records
+ * that no longer validate, and a truncated tail, are cut out so their space
+ * is not lost for good. Sets *dropped when the store was changed.
+ */
+static uint16_t macro_store_parse(bool *dropped) {
+    uint16_t pos = 0;
+    uint16_t out = 0; // Where the next kept record goes
+
+    memset(macro_user, 0, sizeof(macro_user));
+    memset(macro_user_len, 0, sizeof(macro_user_len));
+    *dropped = false;
+
+    while (pos + MACRO_RECORD_HEADER_LEN <= MACRO_STORE_SIZE && macro_store[pos] != 0) {
+        uint8_t len   = macro_store[pos];
+        uint8_t index = macro_store[pos + 1];
+        uint8_t type  = macro_store[pos + 2];
+
+        if (pos + MACRO_RECORD_HEADER_LEN + len > MACRO_STORE_SIZE) break;
+
+        // A record written by an older firmware may not be valid any more
+        if (index < MACRO_COUNT && type <= MACRO_ONCE && macro_validate(&macro_store[pos + MACRO_RECORD_HEADER_LEN], len)) {
+            if (out != pos) memmove(&macro_store[out], &macro_store[pos], MACRO_RECORD_HEADER_LEN + len);
+            macro_user[index].type    = type;
+            macro_user[index].program = &macro_store[out + MACRO_RECORD_HEADER_LEN];
+            macro_user_len[index]     = len;
+            out += MACRO_RECORD_HEADER_LEN + len;
+        } else {
+            dprintf("macro: dropped invalid record for %u\n", index);
+        }
+        pos += MACRO_RECORD_HEADER_LEN + len;
+    }
+
+    // Clear what was cut out, and anything left past the end of the list
+    for (uint16_t i = out; i < MACRO_STORE_SIZE; i++) {
+        if (macro_store[i] != 0) {
+            macro_store[i] = 0;
+            *dropped       = true;
+        }
+    }
+
+    return out;
+}
+
+/* Running macros point into macro_store, stop them before it is rearranged */
+static void macro_store_stop_user(void) {
+    for (uint8_t slot = 0; slot < MACRO_SLOT_COUNT; slot++) {
+        macro_state_t *ma = &macro_slots[slot];
+        if (ma->active && ma->program >= macro_store && ma->program < macro_store + MACRO_STORE_SIZE) {
+            macro_stop(ma);
+        }
+    }
+}
+
+static void macro_store_remove(uint8_t index) {
+    if (!macro_user[index].program) return;
+
+    uint16_t pos = macro_user[index].program - macro_store - MACRO_RECORD_HEADER_LEN;
+    uint16_t len = MACRO_RECORD_HEADER_LEN + macro_user_len[index];
+
+    memmove(&macro_store[pos], &macro_store[pos + len], MACRO_STORE_SIZE - pos - len);
+    memset(&macro_store[MACRO_STORE_SIZE - len], 0, len);
+}
+
+void macro_store_init(void) {
+    bool dropped;
+
+    eeconfig_read_user_datablock(macro_store);
+    macro_store_end = macro_store_parse(&dropped);
+    if (dropped) eeconfig_update_user_datablock(macro_store);
+}
+
+const macro_table_entry_t *macro_store_get(uint16_t keycode) {
+    if (keycode < MACRO_KEYCODE_FIRST || keycode >= MACRO_KEYCODE_LAST) return NULL;
+
+    const macro_table_entry_t *entry = &macro_user[keycode - MACRO_KEYCODE_FIRST];
+    return entry->program ? entry : NULL;
+}
+
+bool macro_store_write(uint8_t index, uint8_t type, const uint8_t *program, uint8_t len) {
+    bool dropped;
+
+    if (index >= MACRO_COUNT || type > MACRO_ONCE || !macro_validate(program, len)) return false;
+
+    uint16_t used = macro_store_end;
+    if (macro_user[index].program) used -= MACRO_RECORD_HEADER_LEN + macro_user_len[index];
+    if (used + MACRO_RECORD_HEADER_LEN + len > MACRO_STORE_SIZE) return false;
+
+    macro_store_stop_user();
+    macro_store_remove(index);
+
+    macro_store[used]     = len;
+    macro_store[used + 1] = index;
+    macro_store[used + 2] = type;
+    memcpy(&macro_store[used + MACRO_RECORD_HEADER_LEN], program, len);
+
+    macro_store_end = macro_store_parse(&dropped);
+    eeconfig_update_user_datablock(macro_store);
+    return true;
+}
+
+bool macro_store_delete(uint8_t index) {
+    bool dropped;
+
+    if (index >= MACRO_COUNT || !macro_user[index].program) return false;
+
+    macro_store_stop_user();
+    macro_store_remove(index);
+
+    macro_store_end = macro_store_parse(&dropped);
+    eeconfig_update_user_datablock(macro_store);
+    return true;
+}
+
+/*
+ * Recording turns key events into M_DOWN/M_UP instructions, with the time
+ * between events kept as M_DELAY. The target macro is either given when
+ * recording starts over raw HID, or picked by pressing a macro key.
+ */
+bool macro_record_active(void) {
+    return macro_rec.active;
+}
+
+static void macro_record_start(uint8_t index, uint8_t type) {
+    macro_stage_index = index;
+    macro_stage_type  = type;
+    macro_rec.active  = true;
+    macro_rec.len     = 0;
+    macro_rec.last    = timer_read32();
+}
+
+static bool macro_record_finish(void) {
+    bool stored = false;
+
+    macro_rec.active = false;
+    if (macro_stage_index != 0xFF && macro_rec.len) {
+        macro_stage[macro_rec.len++] = MACRO_OP_END;
+        stored                       = macro_store_write(macro_stage_index, macro_stage_type, macro_stage, macro_rec.len);
+    }
+    dprintf("macro: recorded %u bytes to %u, %s\n", macro_rec.len, macro_stage_index, stored ? "stored" : "dropped");
+
+    macro_stage_index = 0xFF;
+    return stored;
+}
+
+static void macro_record_append(uint8_t op, uint8_t kc) {
+    uint32_t gap  = timer_elapsed32(macro_rec.last);
+    bool     wait = macro_rec.len && gap >= MACRO_RECORD_MIN_DELAY;
+
+    // Keep a byte free for the final M_END
+    if (macro_rec.len + (wait ? 3 : 0) + 2 + 1 > MACRO_PROGRAM_MAX) return;
+
+    if (wait) {
+        if (gap > UINT16_MAX) gap = UINT16_MAX;
+        macro_stage[macro_rec.len++] = MACRO_OP_DELAY;
+        macro_stage[macro_rec.len++] = gap & 0xFF;
+        macro_stage[macro_rec.len++] = gap >> 8;
+    }
+    macro_stage[macro_rec.len++] = op;
+    macro_stage[macro_rec.len++] = kc;
+    macro_rec.last               = timer_read32();
+}
+
+bool macro_record_process(uint16_t keycode, keyrecord_t *record) {
+    if (keycode == BZ_REC) {
+        if (record->event.pressed) {
+            if (!macro_rec.active) {
+                macro_record_start(0xFF, MACRO_ONCE);
+            } else {
+                macro_record_finish();
+            }
+        }
+        return false;
+    }
+
+    if (!macro_rec.active) return true;
+
+    // Pressing a macro key picks where the recording goes and ends it
+    if (keycode >= MACRO_KEYCODE_FIRST && keycode < MACRO_KEYCODE_LAST) {
+        if (record->event.pressed) {
+            const macro_table_entry_t *entry = macro_get(keycode);
+
+            macro_stage_index = keycode - MACRO_KEYCODE_FIRST;
+            if (entry) macro_stage_type = entry->type;
+            macro_record_finish();
+        }
+        return false;
+    }
+
+    if (keycode <= 0xFF) {
+        macro_record_append(record->event.pressed ? MACRO_OP_DOWN : MACRO_OP_UP, keycode);
+    }
+    return true;
+}
+
+#ifdef RAW_ENABLE
+bool macro_rx(uint8_t *data, uint8_t length) {
+    uint8_t status = MACRO_HID_OK;
+
+    switch (data[1]) {
+        case MACRO_HID_INFO:
+            data[3] = MACRO_COUNT;
+            data[4] = MACRO_STORE_SIZE & 0xFF;
+            data[5] = MACRO_STORE_SIZE >> 8;
+            data[6] = macro_store_end & 0xFF;
+            data[7] = macro_store_end >> 8;
+            data[8] = MACRO_KEYCODE_FIRST & 0xFF;
+            data[9] = MACRO_KEYCODE_FIRST >> 8;
+
+            // Characters per second of the last string a macro typed
+            data[10] = macro_get_typing_rate() & 0xFF;
+            data[11] = macro_get_typing_rate() >> 8;
+            break;
+
+        case MACRO_HID_LIST: {
+            uint8_t index = data[2];
+            uint8_t i     = 3;
+
+            memset(&data[3], 0xFF, length - 3);
+            for (; index < MACRO_COUNT && i + 4 <= length; index++) {
+                const macro_table_entry_t *user  = &macro_user[index];
+                const macro_table_entry_t *entry = macro_get(MACRO_KEYCODE_FIRST + index);
+
+                data[i++] = index;
+                data[i++] = entry ? entry->type : 0;
+                data[i++] = user->program ? MACRO_SOURCE_USER : entry ? MACRO_SOURCE_BUILTIN : MACRO_SOURCE_NONE;
+                data[i++] = user->program ? macro_user_len[index] : 0;
+            }
+        } break;
+
+        case MACRO_HID_BEGIN:
+            if (macro_rec.active) {
+                status = MACRO_HID_ERR_BUSY;
+            } else if (data[2] >= MACRO_COUNT || data[3] > MACRO_ONCE || data[4] == 0) {
+                status = MACRO_HID_ERR_INVALID;
+            } else {
+                macro_stage_index = data[2];
+                macro_stage_type  = data[3];
+                macro_stage_len   = data[4];
+                memset(macro_stage, 0, sizeof(macro_stage));
+            }
+            break;
+
+        case MACRO_HID_DATA: {
+            uint8_t offset = data[2];
+            uint8_t n      = data[3];
+
+            if (macro_stage_index == 0xFF || macro_rec.active) {
+                status = MACRO_HID_ERR_BUSY;
+            } else if (n > length - 4 || offset + n > macro_stage_len) {
+                status = MACRO_HID_ERR_INVALID;
+            } else {
+                memcpy(&macro_stage[offset], &data[4], n);
+            }
+        } break;
+
+        case MACRO_HID_COMMIT:
+            if (macro_stage_index == 0xFF || macro_rec.active) {
+                status = MACRO_HID_ERR_BUSY;
+            } else {
+                if (!macro_validate(macro_stage, macro_stage_len)) {
+                    status = MACRO_HID_ERR_INVALID;
+                } else if (!macro_store_write(macro_stage_index, macro_stage_type, macro_stage, macro_stage_len)) {
+                    status = MACRO_HID_ERR_NO_SPACE;
+                }
+                macro_stage_index = 0xFF;
+            }
+            break;
+
+        case MACRO_HID_DELETE:
+            if (!macro_store_delete(data[2])) status = MACRO_HID_ERR_INVALID;
+            break;
+
+        case MACRO_HID_RECORD:
+            if (data[2] == 0xFF) {
+                if (!macro_rec.active || !macro_record_finish()) status = MACRO_HID_ERR_INVALID;
+            } else if (macro_rec.active) {
+                status = MACRO_HID_ERR_BUSY;
+            } else if (data[2] >= MACRO_COUNT || data[3] > MACRO_ONCE) {
+                status = MACRO_HID_ERR_INVALID;
+            } else {
+                macro_record_start(data[2], data[3]);
+            }
+            break;
+
+        default:
+            status = MACRO_HID_ERR_INVALID;
+            break;
+    }
+
+    data[2] = status;
+    raw_hid_send(data, length);
+    return true;
+}
+#endif
@@ -0,0 +1,59 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "macro.h"
+
+/*
+ * Macros uploaded over raw HID or recorded on the keyboard are kept in the
+ * EECONFIG user datablock as a list of records:
+ *     len, index, type, program[len]
+ * where index is keycode - MACRO_KEYCODE_FIRST. A record with len 0 ends the
+ * list, so an erased datablock is an empty store. A stored macro takes
+ * precedence over the built-in program of the same keycode.
+ */
+#define MACRO_STORE_SIZE EECONFIG_USER_DATA_SIZE
+#define MACRO_RECORD_HEADER_LEN 3
+
+// Programs are addressed with an 8-bit program counter
+#define MACRO_PROGRAM_MAX 255
+
+// Shortest gap between recorded key events that is kept as an M_DELAY
+#ifndef MACRO_RECORD_MIN_DELAY
+#    define MACRO_RECORD_MIN_DELAY 5
+#endif
+
+/*
+ * Raw HID command 0xAC, sub command in data[1]. Replies echo the command
+ * with a status byte in data[2] and any payload from data[3].
+ */
+enum macro_hid_commands {
+    MACRO_HID_INFO = 0x01, //                   -> count, capacity lo, hi, used lo, hi, first keycode lo, hi, chars/s lo, hi
+    MACRO_HID_LIST,        // first             -> up to 7 of index, type, source, len
+    MACRO_HID_BEGIN,       // index, type, len     Start uploading a program
+    MACRO_HID_DATA,        // offset, n, bytes     Upload part of the program
+    MACRO_HID_COMMIT,      //                      Store the uploaded program
+    MACRO_HID_DELETE,      // index                Remove a stored program
+    MACRO_HID_RECORD,      // index, type          Record keystrokes into index, 0xFF stops
+};
+
+enum macro_hid_status {
+    MACRO_HID_OK,
+    MACRO_HID_ERR_INVALID,
+    MACRO_HID_ERR_NO_SPACE,
+    MACRO_HID_ERR_BUSY,
+};
+
+enum macro_sources {
+    MACRO_SOURCE_NONE,
+    MACRO_SOURCE_BUILTIN,
+    MACRO_SOURCE_USER,
+};
+
+void                       macro_store_init(void);
+const macro_table_entry_t *macro_store_get(uint16_t keycode);
+bool                       macro_store_write(uint8_t index, uint8_t type, const uint8_t *program, uint8_t len);
+bool                       macro_store_delete(uint8_t index);
+
+// On-device recording
+bool macro_record_active(void);
+bool macro_record_process(uint16_t keycode, keyrecord_t *record);
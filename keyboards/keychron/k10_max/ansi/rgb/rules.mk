@@ -1,3 +1,4 @@
 # This file intentionally left blank
 RGB_MATRIX_EFFECT_HEATMAP = yes
-SRC += keymaps/k0nker/macro.c
\ No newline at end of file
+SRC += keymaps/k0nker/macro.c
+SRC += keymaps/k0nker/macro_store.c
\ No newline at end of file
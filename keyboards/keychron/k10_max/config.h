@@ -74,6 +74,9 @@
 /* Keep USB connection in wireless mode */
 #    define KEEP_USB_CONNECTION_IN_WIRELESS_MODE
 
+/* Resume from stop mode in place, without halInit() and matrix_init() */
+#    define LPM_FAST_WAKEUP
+
 #endif
 
 /* Factory test keys */
@@ -16,6 +16,7 @@
 
 #include "quantum.h"
 #include "keychron_task.h"
+#include "profiler.h"
 #ifdef FACTORY_TEST_ENABLE
 #    include "factory_test.h"
 #    include "keychron_common.h"
@@ -94,3 +95,23 @@ bool lpm_is_kb_idle(void) {
     return power_on_indicator_timer == 0 && !factory_reset_indicating();
 }
 #endif
+
+#ifdef PROFILER_ENABLE
+/* The K10 Max scans with QMK's native matrix rather than common/matrix.c, so
+ * the scan is timed from the first column select to matrix_scan_kb(), which
+ * QMK calls once the rows have been read and debounced */
+static uint32_t scan_start = 0;
+
+void matrix_output_select_delay(void) {
+    if (!scan_start) scan_start = profiler_cycles() | 1;
+    waitInputPinDelay();
+}
+
+void matrix_scan_kb(void) {
+    if (scan_start) {
+        profiler_record(PROFILE_MATRIX_SCAN, profiler_cycles() - scan_start);
+        scan_start = 0;
+    }
+    matrix_scan_user();
+}
+#endif